@@ -0,0 +1,397 @@
+/**
+ * @file aggregator.c
+ * @brief Aggregation of the metrics of downstream daemons.
+ *
+ * Keeps a persistent session (see CMD_SESSION) open to every downstream daemon.
+ * On every tick all of them are asked for CPU and memory usage at once, the
+ * answers are collected by the event loop. Requests for the aggregated values
+ * are then served from the latest answers without waiting on the network.
+ *
+ * @author Karel Dolezal, akwky@centrum.cz
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+
+#include "common.h"
+#include "aggregator.h"
+#include "loop.h"
+
+// Maximum number of downstream daemons
+#define AGGREGATOR_MAX_HOSTS 64
+// Maximum length of a configured "host:port" item
+#define HOST_NAME_SIZE       64
+// Receive buffer of a downstream connection, must hold at least one response
+#define INPUT_BUFFER_SIZE    256
+// Deadline for connecting to a downstream daemon
+#define CONNECT_TIMEOUT_MS   3000
+// Delay before a lost connection is reopened
+#define RETRY_INTERVAL_MS    5000
+// Values older than this are considered lost, the host is reported as down
+#define STALE_AFTER_MS       3000
+
+// Requests sent on every tick, pipelined in one write
+#define QUERY CMD_CPU CMD_MEM
+// Responses within a session end with an empty line
+#define RESPONSE_END "\n\n"
+#define RESPONSE_CPU_FORMAT "Current CPU usage is %d %%"
+#define RESPONSE_MEM_FORMAT "Current memory usage is %ld kB"
+
+enum downstreamState
+{
+  DownstreamDisconnected = 0,
+  DownstreamConnecting,
+  DownstreamReady,
+};
+
+/**
+ * A downstream daemon and the latest values it reported.
+ */
+struct downstream
+{
+  char name[HOST_NAME_SIZE];
+  struct sockaddr_in address;
+  enum downstreamState state;
+  int socket;                       // -1 when disconnected
+  int timer;                        // connect deadline or reconnect delay
+  char input[INPUT_BUFFER_SIZE];
+  int inputSize;
+  int cpuPercent;
+  long cpuUpdatedMs;                // 0 if never received
+  long memoryKb;
+  long memoryUpdatedMs;             // 0 if never received
+};
+
+static struct downstream downstreams[AGGREGATOR_MAX_HOSTS];
+static int downstreamCount = 0;
+
+void connectDownstream(void *data);
+
+void aggregatorInit(char *hosts)
+{
+  for (char *item = strtok(hosts, ","); item; item = strtok(NULL, ",")) {
+    if (downstreamCount == AGGREGATOR_MAX_HOSTS || strlen(item) >= HOST_NAME_SIZE) {
+      errno = EINVAL;
+      die("aggregatorInit()", ErrArgs);
+    }
+    struct downstream *d = &downstreams[downstreamCount++];
+    memset(d, 0, sizeof(*d));
+    strcpy(d->name, item);
+    d->socket = -1;
+    d->timer = -1;
+
+    // split off the optional port
+    int port = PORT;
+    char host[HOST_NAME_SIZE];
+    strcpy(host, item);
+    char *colon = strchr(host, ':');
+    if (colon) {
+      *colon = '\0';
+      port = atoi(colon + 1);
+    }
+
+    struct hostent *hptr = gethostbyname(host);
+    if (!hptr || port <= 0 || port > 65535) {
+      fprintf(stderr, "%d: Cannot resolve downstream %s\n", getpid(), item);
+      exit(ErrArgs);
+    }
+    memcpy(&d->address.sin_addr, hptr->h_addr_list[0], hptr->h_length);
+    d->address.sin_family = AF_INET;
+    d->address.sin_port = htons(port);
+  }
+}
+
+/**
+ * @brief Closes the connection and schedules a new attempt.
+ *
+ * @param d The downstream daemon.
+ */
+void disconnectDownstream(struct downstream *d)
+{
+  printf("%d: Lost downstream %s, reconnecting in %d ms\n", getpid(), d->name, RETRY_INTERVAL_MS);
+  loopRemoveFd(d->socket);
+  loopCancelTimer(d->timer);
+  close(d->socket);
+  d->socket = -1;
+  d->state = DownstreamDisconnected;
+  d->timer = loopAddTimer(RETRY_INTERVAL_MS, connectDownstream, d);
+  if (d->timer < 0) {
+    printf("%d: Cannot schedule the reconnect of %s, retrying on the next tick\n", getpid(),
+      d->name);
+  }
+}
+
+/**
+ * @brief Gives up a connection attempt which takes too long.
+ *
+ * @param data The downstream daemon.
+ */
+void onConnectTimeout(void *data)
+{
+  struct downstream *d = (struct downstream *) data;
+  d->timer = -1;
+  disconnectDownstream(d);
+}
+
+/**
+ * @brief Sends the queries for the latest values.
+ *
+ * @param d The downstream daemon, must be ready.
+ */
+void queryDownstream(struct downstream *d)
+{
+  int size = strlen(QUERY);
+  if (send(d->socket, QUERY, size, MSG_NOSIGNAL) != size) {
+    disconnectDownstream(d);
+  }
+}
+
+/**
+ * @brief Stores the values found in complete responses.
+ *
+ * @param d The downstream daemon.
+ */
+void parseResponses(struct downstream *d)
+{
+  char *end;
+  while ((end = memmem(d->input, d->inputSize, RESPONSE_END, strlen(RESPONSE_END))) != NULL) {
+    *end = '\0';
+    int cpuPercent;
+    long memoryKb;
+    if (sscanf(d->input, RESPONSE_CPU_FORMAT, &cpuPercent) == 1) {
+      d->cpuPercent = cpuPercent;
+      d->cpuUpdatedMs = nowMs();
+    }
+    else if (sscanf(d->input, RESPONSE_MEM_FORMAT, &memoryKb) == 1) {
+      d->memoryKb = memoryKb;
+      d->memoryUpdatedMs = nowMs();
+    }
+
+    int consumed = end - d->input + strlen(RESPONSE_END);
+    memmove(d->input, d->input + consumed, d->inputSize - consumed);
+    d->inputSize -= consumed;
+  }
+}
+
+/**
+ * @brief Handles the connection progress and the incoming responses.
+ *
+ * @param socket The downstream connection.
+ * @param revents Ignored, errors are reported by the socket calls.
+ * @param data The downstream daemon.
+ */
+void onDownstreamEvent(int socket, short revents, void *data)
+{
+  struct downstream *d = (struct downstream *) data;
+
+  if (d->state == DownstreamConnecting) {
+    int error;
+    socklen_t size = sizeof(error);
+    if (getsockopt(socket, SOL_SOCKET, SO_ERROR, &error, &size) != 0 || error != 0) {
+      disconnectDownstream(d);
+      return;
+    }
+    loopCancelTimer(d->timer);
+    d->timer = -1;
+
+    // switch the downstream into the session mode and ask right away
+    int length = strlen(CMD_SESSION);
+    if (send(socket, CMD_SESSION, length, MSG_NOSIGNAL) != length) {
+      disconnectDownstream(d);
+      return;
+    }
+    printf("%d: Connected to downstream %s\n", getpid(), d->name);
+    d->state = DownstreamReady;
+    d->inputSize = 0;
+    loopModifyFd(socket, POLLIN);
+    queryDownstream(d);
+    return;
+  }
+
+  int size = recv(socket, d->input + d->inputSize, INPUT_BUFFER_SIZE - d->inputSize, 0);
+  if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+    return;
+  }
+  if (size <= 0) {
+    disconnectDownstream(d);
+    return;
+  }
+  d->inputSize += size;
+  parseResponses(d);
+
+  // a full buffer without a complete response means a broken peer
+  if (d->inputSize == INPUT_BUFFER_SIZE) {
+    disconnectDownstream(d);
+  }
+}
+
+/**
+ * @brief Starts a non-blocking connection attempt.
+ *
+ * @param data The downstream daemon.
+ */
+void connectDownstream(void *data)
+{
+  struct downstream *d = (struct downstream *) data;
+  d->timer = -1;
+
+  d->socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (d->socket < 0) {
+    die("socket()", ErrNetwork);
+  }
+  if (connect(d->socket, (struct sockaddr *) &d->address, sizeof(d->address)) != 0 &&
+      errno != EINPROGRESS)
+  {
+    disconnectDownstream(d);
+    return;
+  }
+  d->state = DownstreamConnecting;
+  if (loopAddFd(d->socket, POLLOUT, onDownstreamEvent, d) < 0) {
+    die("loopAddFd()", ErrNetwork);
+  }
+  d->timer = loopAddTimer(CONNECT_TIMEOUT_MS, onConnectTimeout, d);
+  if (d->timer < 0) {
+    // an attempt without a deadline could hang forever
+    disconnectDownstream(d);
+  }
+}
+
+void aggregatorStart()
+{
+  for (int i = 0; i < downstreamCount; i++) {
+    connectDownstream(&downstreams[i]);
+  }
+}
+
+void aggregatorTick()
+{
+  for (int i = 0; i < downstreamCount; i++) {
+    struct downstream *d = &downstreams[i];
+    if (d->state == DownstreamReady) {
+      queryDownstream(d);
+    }
+    else if (d->state == DownstreamDisconnected && d->timer < 0) {
+      // the reconnect delay could not be armed
+      connectDownstream(d);
+    }
+  }
+}
+
+/**
+ * @brief Tells whether the downstream daemon reported both values recently.
+ *
+ * @param d The downstream daemon.
+ * @param now The current nowMs() time.
+ * @returns Nonzero if the values can be used.
+ */
+int isUp(struct downstream *d, long now)
+{
+  return d->cpuUpdatedMs && now - d->cpuUpdatedMs <= STALE_AFTER_MS &&
+         d->memoryUpdatedMs && now - d->memoryUpdatedMs <= STALE_AFTER_MS;
+}
+
+int aggregatorFormatHosts(char *output, int size)
+{
+  int length = 0;
+  int cut = 0;
+  long now = nowMs();
+
+  output[0] = '\0';
+  for (int i = 0; i < downstreamCount; i++) {
+    struct downstream *d = &downstreams[i];
+    if (isUp(d, now)) {
+      cut |= appendFormat(output, &length, size, "%s cpu %d %% mem %ld kB\n",
+        d->name, d->cpuPercent, d->memoryKb);
+    }
+    else {
+      cut |= appendFormat(output, &length, size, "%s down\n", d->name);
+    }
+  }
+  if (downstreamCount == 0) {
+    cut |= appendFormat(output, &length, size, "No downstream daemons\n");
+  }
+  return cut ? -1 : length;
+}
+
+/**
+ * @brief qsort() comparator for the collected values.
+ */
+int compareValues(const void *a, const void *b)
+{
+  long x = *(const long *) a, y = *(const long *) b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * @brief Returns the nearest-rank percentile.
+ *
+ * @param values Sorted values.
+ * @param count The number of values, at least one.
+ * @param percent The percentile, 1 - 100.
+ * @returns The value.
+ */
+long percentile(const long *values, int count, int percent)
+{
+  return values[(percent * count + 99) / 100 - 1];
+}
+
+/**
+ * @brief Appends a line with the statistics of the given values.
+ *
+ * @param output The buffer.
+ * @param length The current length of the content, updated on return.
+ * @param size The size of the buffer.
+ * @param name The name of the metric.
+ * @param values The values, they get sorted.
+ * @param count The number of values, at least one.
+ * @param unit The unit printed after the values.
+ * @returns Zero if the whole line was appended, -1 if it was cut short.
+ */
+int appendStatistics(char *output, int *length, int size, const char *name,
+  long *values, int count, const char *unit)
+{
+  qsort(values, count, sizeof(*values), compareValues);
+
+  long sum = 0;
+  for (int i = 0; i < count; i++) {
+    sum += values[i];
+  }
+  return appendFormat(output, length, size,
+    "%s min %ld max %ld avg %.1f p50 %ld p90 %ld p99 %ld %s\n", name, values[0],
+    values[count - 1], (double) sum / count, percentile(values, count, 50),
+    percentile(values, count, 90), percentile(values, count, 99), unit);
+}
+
+int aggregatorFormatCluster(char *output, int size)
+{
+  long cpu[AGGREGATOR_MAX_HOSTS];
+  long memory[AGGREGATOR_MAX_HOSTS];
+  int count = 0;
+  int length = 0;
+  int cut = 0;
+  long now = nowMs();
+
+  for (int i = 0; i < downstreamCount; i++) {
+    if (isUp(&downstreams[i], now)) {
+      cpu[count] = downstreams[i].cpuPercent;
+      memory[count] = downstreams[i].memoryKb;
+      count++;
+    }
+  }
+
+  output[0] = '\0';
+  cut |= appendFormat(output, &length, size, "hosts %d up %d\n", downstreamCount, count);
+  if (count > 0) {
+    cut |= appendStatistics(output, &length, size, "cpu", cpu, count, "%");
+    cut |= appendStatistics(output, &length, size, "mem", memory, count, "kB");
+  }
+  return cut ? -1 : length;
+}
@@ -0,0 +1,55 @@
+/**
+ * @file aggregator.h
+ * @brief Aggregation of the metrics of downstream daemons.
+ *
+ * @author Karel Dolezal, akwky@centrum.cz
+ */
+
+#ifndef _AGGREGATOR_H_
+#define _AGGREGATOR_H_
+
+/**
+ * @brief Configures the downstream daemons.
+ *
+ * Host names are resolved right away, the function exits if one cannot be.
+ *
+ * @param hosts Comma separated list of "host" or "host:port" items. The string
+ *              is modified.
+ */
+void aggregatorInit(char *hosts);
+
+/**
+ * @brief Opens the persistent connections to the downstream daemons.
+ *
+ * Must be called once the event loop is initialized. Lost connections are
+ * reopened automatically.
+ */
+void aggregatorStart();
+
+/**
+ * @brief Queries all connected downstream daemons at once.
+ *
+ * Meant to be called periodically, the answers arrive through the event loop.
+ * Downstreams whose reconnect could not be scheduled are reconnected here.
+ */
+void aggregatorTick();
+
+/**
+ * @brief Writes the latest values of each downstream daemon.
+ *
+ * @param output The buffer.
+ * @param size The size of the buffer.
+ * @returns The length of the text, -1 if it did not fit into the buffer.
+ */
+int aggregatorFormatHosts(char *output, int size);
+
+/**
+ * @brief Writes min, max, average and percentiles of the latest values.
+ *
+ * @param output The buffer.
+ * @param size The size of the buffer.
+ * @returns The length of the text, -1 if it did not fit into the buffer.
+ */
+int aggregatorFormatCluster(char *output, int size);
+
+#endif
@@ -0,0 +1,243 @@
+/**
+ * @file alerts.c
+ * @brief Threshold and rate of change alerts on the sampled values.
+ *
+ * Every rule is compiled into the same predicate over one of a few inputs:
+ * the input is multiplied by the sign of the rule, the rule fires when the
+ * product exceeds the fire level and clears when it drops below the clear
+ * level. "below" and "fall" rules just have a negative sign. The predicates
+ * are kept in a flat array, apart from the text needed only for the events,
+ * so that checking thousands of rules on every sample is a tight loop.
+ *
+ * @author Karel Dolezal, akwky@centrum.cz
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "common.h"
+#include "alerts.h"
+
+// Length of the rule description used in the events
+#define DESCRIPTION_SIZE 64
+
+/**
+ * Values the rules are evaluated on.
+ */
+enum alertInput
+{
+  InputCpu = 0,       // percent
+  InputMemory,        // kB
+  InputCpuRate,       // percent per second
+  InputMemoryRate,    // kB per second
+  InputRemoved,       // always NAN, compares false to anything
+  InputCount,
+};
+
+/**
+ * A compiled rule.
+ */
+struct predicate
+{
+  double fire;        // fires when sign * input > fire
+  double clear;       // clears when sign * input < clear, clear <= fire
+  int input;          // enum alertInput
+  int sign;           // 1 or -1
+  int active;         // nonzero while fired
+};
+
+/**
+ * The rest of a rule, needed only when an event is sent.
+ */
+struct ruleInfo
+{
+  void *owner;        // NULL once removed
+  int id;
+  char description[DESCRIPTION_SIZE];
+};
+
+static struct predicate predicates[ALERTS_MAX_RULES];
+static struct ruleInfo infos[ALERTS_MAX_RULES];
+static int ruleCount = 0;
+static int removedCount = 0;
+static int nextId = 1;
+static int evaluating = 0;
+static alertsCallback deliver = NULL;
+
+// The previous sample, for the rates of change
+static double previousCpu, previousMemory;
+static long previousMs = 0;
+
+void alertsInit(alertsCallback callback)
+{
+  deliver = callback;
+}
+
+int alertsAdd(void *owner, const char *request, char *response, int size)
+{
+  char metric[4] = "", kind[6] = "";
+  double level, clear;
+  int length = 0;
+
+  int count = sscanf(request, CMD_ALERT "%3[a-z] %5[a-z] %lf clear %lf", metric, kind, &level, &clear);
+  if (count == 3) {
+    clear = level;
+  }
+
+  struct predicate p = { 0, 0, 0, 0, 0 };
+  int isCpu = strcmp(metric, "cpu") == 0;
+  int valid = count >= 3 && (isCpu || strcmp(metric, "mem") == 0);
+  if (valid && (strcmp(kind, "above") == 0 || strcmp(kind, "below") == 0)) {
+    p.input = isCpu ? InputCpu : InputMemory;
+    p.sign = kind[0] == 'a' ? 1 : -1;
+    p.fire = p.sign * level;
+    p.clear = p.sign * clear;
+  }
+  else if (valid && (strcmp(kind, "rise") == 0 || strcmp(kind, "fall") == 0)) {
+    // the levels are speeds, a fall is a rise of the negated rate
+    p.input = isCpu ? InputCpuRate : InputMemoryRate;
+    p.sign = kind[0] == 'r' ? 1 : -1;
+    p.fire = level;
+    p.clear = clear;
+  }
+  else {
+    valid = 0;
+  }
+  if (!valid || !(p.clear <= p.fire)) {
+    appendFormat(response, &length, size, "Invalid alert rule\n");
+    return length;
+  }
+  if (ruleCount == ALERTS_MAX_RULES || alertsCount(owner) >= ALERTS_MAX_OWNER_RULES) {
+    appendFormat(response, &length, size, "Too many alert rules\n");
+    return length;
+  }
+
+  struct ruleInfo *info = &infos[ruleCount];
+  info->owner = owner;
+  info->id = nextId++;
+  if (count == 3) {
+    snprintf(info->description, DESCRIPTION_SIZE, "%s %s %g", metric, kind, level);
+  }
+  else {
+    snprintf(info->description, DESCRIPTION_SIZE, "%s %s %g clear %g", metric, kind,
+      level, clear);
+  }
+  predicates[ruleCount++] = p;
+
+  appendFormat(response, &length, size, "Alert %d added\n", info->id);
+  return length;
+}
+
+/**
+ * @brief Drops the removed rules, keeping the array dense.
+ */
+void compactRules()
+{
+  int kept = 0;
+  for (int i = 0; i < ruleCount; i++) {
+    if (infos[i].owner) {
+      predicates[kept] = predicates[i];
+      infos[kept] = infos[i];
+      kept++;
+    }
+  }
+  ruleCount = kept;
+  removedCount = 0;
+}
+
+/**
+ * @brief Marks a rule as removed, it is dropped once no evaluation is running.
+ *
+ * @param i The index of the rule.
+ */
+void removeRule(int i)
+{
+  infos[i].owner = NULL;
+  predicates[i].input = InputRemoved;
+  removedCount++;
+}
+
+int alertsRemove(void *owner, const char *request, char *response, int size)
+{
+  int id, length = 0;
+
+  if (sscanf(request, CMD_UNALERT "%d", &id) == 1) {
+    for (int i = 0; i < ruleCount; i++) {
+      if (infos[i].owner == owner && infos[i].id == id) {
+        removeRule(i);
+        if (!evaluating) {
+          compactRules();
+        }
+        appendFormat(response, &length, size, "Alert %d removed\n", id);
+        return length;
+      }
+    }
+  }
+  appendFormat(response, &length, size, "Unknown alert\n");
+  return length;
+}
+
+void alertsRemoveOwner(void *owner)
+{
+  for (int i = 0; i < ruleCount; i++) {
+    if (infos[i].owner == owner) {
+      removeRule(i);
+    }
+  }
+  if (!evaluating && removedCount > 0) {
+    compactRules();
+  }
+}
+
+int alertsCount(void *owner)
+{
+  int count = 0;
+  for (int i = 0; i < ruleCount; i++) {
+    count += infos[i].owner == owner;
+  }
+  return count;
+}
+
+void alertsEvaluate(double cpuPercent, double memoryKb, long now)
+{
+  double inputs[InputCount];
+  char event[DESCRIPTION_SIZE + 64];
+
+  // rates are unknown until there are two samples
+  inputs[InputCpu] = cpuPercent;
+  inputs[InputMemory] = memoryKb;
+  inputs[InputCpuRate] = NAN;
+  inputs[InputMemoryRate] = NAN;
+  inputs[InputRemoved] = NAN;
+  if (previousMs && now > previousMs) {
+    inputs[InputCpuRate] = (cpuPercent - previousCpu) * 1000 / (now - previousMs);
+    inputs[InputMemoryRate] = (memoryKb - previousMemory) * 1000 / (now - previousMs);
+  }
+  previousCpu = cpuPercent;
+  previousMemory = memoryKb;
+  previousMs = now;
+
+  evaluating = 1;
+  for (int i = 0; i < ruleCount; i++) {
+    struct predicate *p = &predicates[i];
+    double value = p->sign * inputs[p->input];
+    int change = p->active ? value < p->clear : value > p->fire;
+    if (!change) {
+      continue;
+    }
+    p->active = !p->active;
+    snprintf(event, sizeof(event), "Alert %d %s: %s, value %.1f\n", infos[i].id,
+      p->active ? "fired" : "cleared", infos[i].description, inputs[p->input]);
+    if (deliver) {
+      deliver(infos[i].owner, event);
+    }
+  }
+  evaluating = 0;
+
+  if (removedCount > 0) {
+    compactRules();
+  }
+}
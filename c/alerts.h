@@ -0,0 +1,83 @@
+/**
+ * @file alerts.h
+ * @brief Threshold and rate of change alerts on the sampled values.
+ *
+ * @author Karel Dolezal, akwky@centrum.cz
+ */
+
+#ifndef _ALERTS_H_
+#define _ALERTS_H_
+
+// Maximum number of rules of all clients together
+#define ALERTS_MAX_RULES 4096
+
+// Maximum number of rules of one client, so that no client takes all of them
+#define ALERTS_MAX_OWNER_RULES (ALERTS_MAX_RULES / 64)
+
+/**
+ * @brief Called when a rule fires or clears.
+ *
+ * @param owner The owner given when the rule was added.
+ * @param event The event text, a single terminated line.
+ */
+typedef void (*alertsCallback)(void *owner, const char *event);
+
+/**
+ * @brief Sets the function the events are delivered to.
+ *
+ * @param callback The function.
+ */
+void alertsInit(alertsCallback callback);
+
+/**
+ * @brief Adds a rule, "alert cpu|mem above|below|rise|fall <level> [clear <level>]".
+ *
+ * CPU usage is in percent, memory in kB, rise and fall in these units per
+ * second. The rule fires once the level is crossed and clears once the value
+ * gets back over the clear level, which defaults to the level. A client holds
+ * at most ALERTS_MAX_OWNER_RULES rules.
+ *
+ * @param owner Identifies the client, the events are delivered with it.
+ * @param request The request line, terminated.
+ * @param response The buffer for the response.
+ * @param size The size of the buffer.
+ * @returns The length of the response.
+ */
+int alertsAdd(void *owner, const char *request, char *response, int size);
+
+/**
+ * @brief Removes a rule of the client, "unalert <id>".
+ *
+ * @param owner Identifies the client.
+ * @param request The request line, terminated.
+ * @param response The buffer for the response.
+ * @param size The size of the buffer.
+ * @returns The length of the response.
+ */
+int alertsRemove(void *owner, const char *request, char *response, int size);
+
+/**
+ * @brief Removes all rules of a client. May be called from the callback.
+ *
+ * @param owner Identifies the client.
+ */
+void alertsRemoveOwner(void *owner);
+
+/**
+ * @brief Returns the number of rules of a client.
+ *
+ * @param owner Identifies the client.
+ * @returns The number of rules.
+ */
+int alertsCount(void *owner);
+
+/**
+ * @brief Checks all rules against a new sample and delivers the events.
+ *
+ * @param cpuPercent The CPU usage.
+ * @param memoryKb The memory usage.
+ * @param now The nowMs() time of the sample, used for the rates of change.
+ */
+void alertsEvaluate(double cpuPercent, double memoryKb, long now);
+
+#endif
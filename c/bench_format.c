@@ -0,0 +1,239 @@
+/**
+ * @file bench_format.c
+ * @brief Measures the share of response formatting in the CPU time of a request.
+ *
+ * For the "cpu", "mem" and "stats" responses, the CPU time of producing the
+ * values, of formatting the response and of sending it over a Unix socket pair
+ * is measured. Formatting is measured both the old way, printf() into a buffer
+ * sent by send(), and by assembling fragments sent by a single sendmsg() with
+ * the builders of response.c the server uses. Both must produce the same bytes.
+ *
+ * @author Karel Dolezal, akwky@centrum.cz
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "common.h"
+#include "metrics.h"
+#include "response.h"
+#include "tasks.h"
+
+#define USAGE "Usage: bench_format [-n <iterations>] [<snapshot directory>]\n"
+#define OPTION_ITERATIONS "-n"
+// Number of requests per measurement unless specified
+#define DEFAULT_ITERATIONS 20000
+// Number of responses sent before the socket is drained, off the clock
+#define SEND_BATCH 32
+#define BUFFER_SIZE 4096
+
+/**
+ * The values a response is made of.
+ */
+struct values
+{
+  float cpuUsage;
+  long memoryKb;
+};
+
+/**
+ * A response kind and the ways of producing it.
+ */
+struct kind
+{
+  const char *name;
+  void (*task)(struct values *values);
+  int (*printfFormat)(const struct values *values, char *output, int size);
+  void (*fragmentFormat)(const struct values *values, struct response *r);
+};
+
+void taskCpu(struct values *values)
+{
+  taskSampleCpu();
+  values->cpuUsage = taskGetSampledCpuUsage();
+}
+
+int printfCpu(const struct values *values, char *output, int size)
+{
+  int length = 0;
+  appendFormat(output, &length, size, "Current CPU usage is %d %%\n",
+    (int) (values->cpuUsage * 100 + 0.5));
+  return length;
+}
+
+void fragmentsCpu(const struct values *values, struct response *r)
+{
+  responseCpuUsage(r, values->cpuUsage);
+}
+
+void taskMem(struct values *values)
+{
+  values->memoryKb = taskGetUsedMemoryKb();
+}
+
+int printfMem(const struct values *values, char *output, int size)
+{
+  int length = 0;
+  appendFormat(output, &length, size, "Current memory usage is %ld kB\n", values->memoryKb);
+  return length;
+}
+
+void fragmentsMem(const struct values *values, struct response *r)
+{
+  responseMemoryUsage(r, values->memoryKb);
+}
+
+void taskStats(struct values *values)
+{
+  metricsIncrement(MetricRequests);
+}
+
+int printfStats(const struct values *values, char *output, int size)
+{
+  int length = 0;
+  for (int i = 0; i < MetricCount; i++) {
+    appendFormat(output, &length, size, "%s %lu\n", metricsName(i), metricsGet(i));
+  }
+  return length;
+}
+
+void fragmentsStats(const struct values *values, struct response *r)
+{
+  responseCounters(r);
+}
+
+static const struct kind kinds[] = {
+  { "cpu", taskCpu, printfCpu, fragmentsCpu },
+  { "mem", taskMem, printfMem, fragmentsMem },
+  { "stats", taskStats, printfStats, fragmentsStats },
+};
+
+/**
+ * @brief Reads everything sent so far.
+ *
+ * @param socket The receiving end of the socket pair.
+ */
+void drain(int socket)
+{
+  char buffer[BUFFER_SIZE];
+  while (recv(socket, buffer, sizeof(buffer), MSG_DONTWAIT) > 0) {
+  }
+}
+
+/**
+ * @brief Measures one response kind and prints the results.
+ *
+ * @param kind The response kind.
+ * @param iterations The number of requests.
+ * @param sockets A connected socket pair.
+ * @returns Nonzero if both ways produced the same, complete response.
+ */
+int benchmark(const struct kind *kind, int iterations, int sockets[2])
+{
+  static char text[BUFFER_SIZE], copy[BUFFER_SIZE];
+  struct values values = { 0, 0 };
+  struct response r;
+  long long start, taskNs = 0, printfNs = 0, fragmentsNs = 0, sendNs = 0, sendmsgNs = 0;
+  int length = 0;
+
+  // the first call may allocate buffers of the C library
+  kind->task(&values);
+
+  for (int done = 0; done < iterations; done += SEND_BATCH) {
+    start = clockNs(CLOCK_THREAD_CPUTIME_ID);
+    for (int i = 0; i < SEND_BATCH; i++) {
+      kind->task(&values);
+    }
+    taskNs += clockNs(CLOCK_THREAD_CPUTIME_ID) - start;
+
+    start = clockNs(CLOCK_THREAD_CPUTIME_ID);
+    for (int i = 0; i < SEND_BATCH; i++) {
+      length = kind->printfFormat(&values, text, sizeof(text));
+    }
+    printfNs += clockNs(CLOCK_THREAD_CPUTIME_ID) - start;
+
+    start = clockNs(CLOCK_THREAD_CPUTIME_ID);
+    for (int i = 0; i < SEND_BATCH; i++) {
+      send(sockets[0], text, length, MSG_NOSIGNAL);
+    }
+    sendNs += clockNs(CLOCK_THREAD_CPUTIME_ID) - start;
+    drain(sockets[1]);
+
+    start = clockNs(CLOCK_THREAD_CPUTIME_ID);
+    for (int i = 0; i < SEND_BATCH; i++) {
+      responseInit(&r, text, sizeof(text));
+      kind->fragmentFormat(&values, &r);
+    }
+    fragmentsNs += clockNs(CLOCK_THREAD_CPUTIME_ID) - start;
+
+    // every sendmsg() needs a response not sent yet
+    start = clockNs(CLOCK_THREAD_CPUTIME_ID);
+    for (int i = 0; i < SEND_BATCH; i++) {
+      responseInit(&r, text, sizeof(text));
+      kind->fragmentFormat(&values, &r);
+      responseSend(&r, sockets[0], MSG_NOSIGNAL);
+    }
+    sendmsgNs += clockNs(CLOCK_THREAD_CPUTIME_ID) - start;
+    drain(sockets[1]);
+  }
+  // the assembly was measured on its own, leave just the sendmsg() calls
+  sendmsgNs -= fragmentsNs;
+
+  int requests = (iterations + SEND_BATCH - 1) / SEND_BATCH * SEND_BATCH;
+  double task = (double) taskNs / requests;
+  double formatPrintf = (double) printfNs / requests;
+  double formatFragments = (double) fragmentsNs / requests;
+  double sendPrintf = (double) sendNs / requests;
+  double sendFragments = (double) sendmsgNs / requests;
+  printf("%-6s %9.0f %9.0f %9.0f %5.1f %% %9.0f %9.0f %5.1f %%\n", kind->name, task,
+    formatPrintf, sendPrintf, 100 * formatPrintf / (task + formatPrintf + sendPrintf),
+    formatFragments, sendFragments, 
+    100 * formatFragments / (task + formatFragments + sendFragments));
+
+  responseInit(&r, text, sizeof(text));
+  kind->fragmentFormat(&values, &r);
+  int copied = responseCopy(&r, copy, sizeof(copy));
+  length = kind->printfFormat(&values, text, sizeof(text));
+  return !r.overflow && copied == length && memcmp(copy, text, length) == 0;
+}
+
+int main(int argc, char *argv[])
+{
+  int iterations = DEFAULT_ITERATIONS;
+  int first = 1;
+  int sockets[2];
+
+  if (argc > 2 && strcmp(argv[1], OPTION_ITERATIONS) == 0) {
+    iterations = atoi(argv[2]);
+    first = 3;
+  }
+  if (argc - first > 1 || iterations <= 0) {
+    printf(USAGE);
+    return ErrArgs;
+  }
+  if (first < argc) {
+    taskSetProcRoot(argv[first]);
+  }
+  metricsInit();
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+    die("socketpair()", ErrNetwork);
+  }
+
+  // CPU time per request in ns, the share is formatting / (task + format + send)
+  printf("%-6s %9s %9s %9s %7s %9s %9s %7s\n", "", "task", "printf", "send", "share",
+    "fragments", "sendmsg", "share");
+  int result = ErrOK;
+  for (int j = 0; j < (int) (sizeof(kinds) / sizeof(kinds[0])); j++) {
+    if (!benchmark(&kinds[j], iterations, sockets)) {
+      printf("%s: the responses differ\n", kinds[j].name);
+      result = ErrProcess;
+    }
+  }
+  return result;
+}
@@ -0,0 +1,135 @@
+/**
+ * @file bench_latency.c
+ * @brief Compares local request latency over loopback TCP and a Unix domain socket.
+ *
+ * Expects a running server started with "-U <path>". Sends the same request
+ * repeatedly over both transports, one connection per request like the client
+ * does, and prints latency statistics for each.
+ *
+ * @author Karel Dolezal, akwky@centrum.cz
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "common.h"
+
+#define USAGE "Usage: bench_latency </path | @name> [requests]\n"
+// Number of requests per transport unless specified
+#define DEFAULT_REQUESTS 1000
+// The request sent, "stats" is served without touching /proc
+#define BENCH_REQUEST CMD_STATS
+#define RECV_BUFFER_SIZE 512
+
+/**
+ * @brief Performs one request over a new connection.
+ *
+ * @param address The server address.
+ * @param length The address length.
+ * @returns The round trip time in nanoseconds, from connect() to the end of the response.
+ */
+long long timeRequest(struct sockaddr *address, socklen_t length)
+{
+  char buffer[RECV_BUFFER_SIZE];
+
+  long long start = clockNs(CLOCK_MONOTONIC);
+  int sock = socket(address->sa_family, SOCK_STREAM, 0);
+  if (sock < 0) {
+    die("socket()", ErrNetwork);
+  }
+  if (connect(sock, address, length) != 0) {
+    die("connect()", ErrNetwork);
+  }
+  int requestLength = strlen(BENCH_REQUEST);
+  if (send(sock, BENCH_REQUEST, requestLength, 0) != requestLength) {
+    die("send()", ErrNetwork);
+  }
+  int size;
+  while ((size = recv(sock, buffer, sizeof(buffer), 0)) > 0) {
+  }
+  if (size < 0) {
+    die("recv()", ErrNetwork);
+  }
+  close(sock);
+  return clockNs(CLOCK_MONOTONIC) - start;
+}
+
+/**
+ * @brief qsort() comparator for the measurements.
+ */
+int compareLatency(const void *a, const void *b)
+{
+  long long x = *(const long long *) a, y = *(const long long *) b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * @brief Measures and prints the latency over one transport.
+ *
+ * @param name The transport name to print.
+ * @param address The server address.
+ * @param length The address length.
+ * @param samples Storage for the measurements.
+ * @param count The number of requests.
+ */
+void benchmark(const char *name, struct sockaddr *address, socklen_t length,
+  long long *samples, int count)
+{
+  long long total = 0;
+  for (int i = 0; i < count; i++) {
+    samples[i] = timeRequest(address, length);
+    total += samples[i];
+  }
+  qsort(samples, count, sizeof(*samples), compareLatency);
+
+  printf("%-10s requests %6d  avg %8.1f us  p50 %8.1f us  p99 %8.1f us  min %8.1f us\n",
+    name, count, total / 1000.0 / count, samples[count / 2] / 1000.0,
+    samples[(int) (count * 0.99)] / 1000.0, samples[0] / 1000.0);
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc < 2 || argc > 3) {
+    printf(USAGE);
+    return ErrArgs;
+  }
+  int count = argc == 3 ? atoi(argv[2]) : DEFAULT_REQUESTS;
+  if (count <= 0) {
+    printf(USAGE);
+    return ErrArgs;
+  }
+
+  struct sockaddr_in tcpAddress;
+  memset(&tcpAddress, 0, sizeof(tcpAddress));
+  tcpAddress.sin_family = AF_INET;
+  tcpAddress.sin_port = htons(PORT);
+  tcpAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  struct sockaddr_un unixAddress;
+  socklen_t unixLength = fillUnixAddress(argv[1], &unixAddress);
+  if (unixLength == 0) {
+    printf(USAGE);
+    return ErrArgs;
+  }
+
+  long long *samples = malloc(sizeof(*samples) * count);
+  if (!samples) {
+    die("malloc()", ErrProcess);
+  }
+
+  // warm up both paths first
+  timeRequest((struct sockaddr *) &tcpAddress, sizeof(tcpAddress));
+  timeRequest((struct sockaddr *) &unixAddress, unixLength);
+  benchmark("tcp", (struct sockaddr *) &tcpAddress, sizeof(tcpAddress), samples, count);
+  benchmark("unix", (struct sockaddr *) &unixAddress, unixLength, samples, count);
+
+  free(samples);
+  return ErrOK;
+}
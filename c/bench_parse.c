@@ -0,0 +1,153 @@
+/**
+ * @file bench_parse.c
+ * @brief Measures the parsers of tasks.c on captured /proc snapshots.
+ *
+ * Every snapshot directory holds "meminfo" and "stat" files (see corpus/).
+ * The stat file is parsed twice, for the total CPU time and for the per-core
+ * times summed by the NUMA sampler threads of all cores.
+ * Each source is parsed repeatedly through the same functions the daemon uses,
+ * with the proc root pointed at the snapshot, and the time and the number of
+ * heap allocations per parse are printed.
+ *
+ * @author Karel Dolezal, akwky@centrum.cz
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "numa.h"
+#include "tasks.h"
+
+#define USAGE "Usage: bench_parse [-n <iterations>] <snapshot directory>...\n"
+#define OPTION_ITERATIONS "-n"
+// Number of parses per source unless specified
+#define DEFAULT_ITERATIONS 10000
+
+// The allocator of glibc, wrapped below to count the allocations
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+
+// Number of allocations made by the whole process, including the C library
+static unsigned long allocations = 0;
+
+void *malloc(size_t size)
+{
+  allocations++;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+  allocations++;
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size)
+{
+  allocations++;
+  return __libc_realloc(pointer, size);
+}
+
+/**
+ * @brief Parses the meminfo file once.
+ */
+void parseMeminfo()
+{
+  volatile long used = taskGetUsedMemoryKb();
+  (void) used;
+}
+
+/**
+ * @brief Parses the stat file once.
+ */
+void parseStat()
+{
+  taskSampleCpu();
+}
+
+/**
+ * @brief Parses the per-core lines of the stat file once, for every core.
+ */
+void parseNodeStat()
+{
+  static cpu_set_t allCpus;
+  static int initialized = 0;
+  long working, idle;
+
+  if (!initialized) {
+    CPU_ZERO(&allCpus);
+    for (int i = 0; i < CPU_SETSIZE; i++) {
+      CPU_SET(i, &allCpus);
+    }
+    initialized = 1;
+  }
+  numaReadCpuTimes(&allCpus, &working, &idle);
+}
+
+/**
+ * A metric source and the function parsing it.
+ */
+struct source
+{
+  const char *name;
+  void (*parse)();
+};
+
+static const struct source sources[] = {
+  { "meminfo", parseMeminfo },
+  { "stat", parseStat },
+  { "nodestat", parseNodeStat },
+};
+
+/**
+ * @brief Measures one source of one snapshot and prints the results.
+ *
+ * @param snapshot The snapshot directory.
+ * @param source The source.
+ * @param iterations The number of parses.
+ */
+void benchmark(const char *snapshot, const struct source *source, int iterations)
+{
+  // the first parse may allocate buffers of the C library
+  source->parse();
+
+  unsigned long allocationsBefore = allocations;
+  long long start = clockNs(CLOCK_MONOTONIC);
+  for (int i = 0; i < iterations; i++) {
+    source->parse();
+  }
+  long long elapsed = clockNs(CLOCK_MONOTONIC) - start;
+  unsigned long allocated = allocations - allocationsBefore;
+
+  printf("%-32s %-8s %10.0f ns/parse %6.2f allocs/parse\n", snapshot, source->name,
+    (double) elapsed / iterations, (double) allocated / iterations);
+}
+
+int main(int argc, char *argv[])
+{
+  int iterations = DEFAULT_ITERATIONS;
+  int first = 1;
+
+  if (argc > 2 && strcmp(argv[1], OPTION_ITERATIONS) == 0) {
+    iterations = atoi(argv[2]);
+    first = 3;
+  }
+  if (first >= argc || iterations <= 0) {
+    printf(USAGE);
+    return ErrArgs;
+  }
+
+  for (int i = first; i < argc; i++) {
+    taskSetProcRoot(argv[i]);
+    for (int j = 0; j < (int) (sizeof(sources) / sizeof(sources[0])); j++) {
+      benchmark(argv[i], &sources[j], iterations);
+    }
+  }
+  return ErrOK;
+}
@@ -7,6 +7,8 @@
  *
  * @author Karel Dolezal, akwky@centrum.cz
  */
+
+#define _GNU_SOURCE
  
 #include <stdio.h>
 #include <stdlib.h>
@@ -15,17 +17,40 @@
 #include <string.h>
 #include <netdb.h>
 #include <unistd.h>
+#include <errno.h>
+#include <poll.h>
 
 #include "common.h"
+#include "shmpage.h"
 
 // Size of the receive buffer. Can be any reasonable size.
 #define RECV_BUFFER_SIZE 80
+// Size of the buffer for a UDP response, which must arrive in one datagram.
+// The largest possible datagram fits, a longer one would be reported as truncated.
+#define DATAGRAM_BUFFER_SIZE 65536
+// Deadline for establishing the connection.
+#define CONNECT_TIMEOUT_MS 3000
+// Deadline for sending the request and receiving the whole response.
+// The server measures CPU usage for a second, so keep this well above that.
+#define IO_TIMEOUT_MS      5000
 // Help text displayed in case of invalid arguments are specified.
-#define USAGE "Usage: client <server> (-c | -m)\n"
+#define USAGE "Usage: client <server[:port] | unix:/path | unix:@name | shm:/name> [-u] (-c | -m | -s | -l | -a | -t | -T | -P | -n | -N)\n"
+// Prefix of a server address selecting the daemon's shared memory page
+#define SHM_PREFIX "shm:"
 
 // The supported requests as command line arguments.
 #define OPTION_CPU "-c"
 #define OPTION_MEM "-m"
+#define OPTION_STATS "-s"
+#define OPTION_HOSTS "-l"
+#define OPTION_CLUSTER "-a"
+#define OPTION_TOP_CPU "-t"
+#define OPTION_TOP_MEM "-T"
+#define OPTION_PROFILE "-P"
+#define OPTION_NODE_CPU "-n"
+#define OPTION_NODE_MEM "-N"
+// Switches the transport to UDP.
+#define OPTION_UDP "-u"
 
 /**
  * @Brief Checks the command line arguments.
@@ -36,22 +61,49 @@
  * @param argv Array of argument strings
  * @param server The server address is passed back through here
  * @param request The request string is passed back through here
+ * @param udp Set to nonzero if UDP should be used instead of TCP
  */
-void processArguments(int argc, char *argv[], char **server, char **request)
+void processArguments(int argc, char *argv[], char **server, char **request, int *udp)
 {
-  if (argc != 3) {
+  *udp = argc == 4 && strcmp(argv[2], OPTION_UDP) == 0;
+  if (argc != 3 + *udp) {
     printf(USAGE);
     exit(ErrArgs);
   }
+  char *option = argv[argc - 1];
   
   // translate cmd line options to the full command string
   *request = "\n";
-  if (strcmp(argv[2], OPTION_CPU) == 0) {
+  if (strcmp(option, OPTION_CPU) == 0) {
     *request = CMD_CPU;
   }
-  if (strcmp(argv[2], OPTION_MEM) == 0) {
+  if (strcmp(option, OPTION_MEM) == 0) {
     *request = CMD_MEM;
   }
+  if (strcmp(option, OPTION_STATS) == 0) {
+    *request = CMD_STATS;
+  }
+  if (strcmp(option, OPTION_HOSTS) == 0) {
+    *request = CMD_HOSTS;
+  }
+  if (strcmp(option, OPTION_CLUSTER) == 0) {
+    *request = CMD_CLUSTER;
+  }
+  if (strcmp(option, OPTION_TOP_CPU) == 0) {
+    *request = CMD_TOP_CPU;
+  }
+  if (strcmp(option, OPTION_TOP_MEM) == 0) {
+    *request = CMD_TOP_MEM;
+  }
+  if (strcmp(option, OPTION_PROFILE) == 0) {
+    *request = CMD_PROFILE;
+  }
+  if (strcmp(option, OPTION_NODE_CPU) == 0) {
+    *request = CMD_NODE_CPU;
+  }
+  if (strcmp(option, OPTION_NODE_MEM) == 0) {
+    *request = CMD_NODE_MEM;
+  }
   if ((*request)[0] == '\n') {
     printf(USAGE);
     exit(ErrArgs);
@@ -59,22 +111,75 @@ void processArguments(int argc, char *argv[], char **server, char **request)
   
   // the server adress string is simply passed "as is"
   *server = argv[1];
+  if (*udp && strncmp(*server, UNIX_PREFIX, strlen(UNIX_PREFIX)) == 0) {
+    printf(USAGE);
+    exit(ErrArgs);
+  }
+  // the shared memory page holds only the sampled values
+  if (strncmp(*server, SHM_PREFIX, strlen(SHM_PREFIX)) == 0 && 
+      (*udp || (strcmp(*request, CMD_CPU) != 0 && strcmp(*request, CMD_MEM) != 0))) 
+  {
+    printf(USAGE);
+    exit(ErrArgs);
+  }
 }
 
 /**
- * @brief Returns socket connected to the given address and port.
- * Resolves the server address and opens a TCP connection.
+ * @brief Waits until the socket is ready for the given operation.
+ *
+ * Note: Due to simplicity of this client, this function just exits when the
+ * deadline expires.
+ *
+ * @param sock The socket.
+ * @param events POLLIN or POLLOUT.
+ * @param deadline The nowMs() based time by which the socket must be ready.
+ * @param caller The name of the operation reported on timeout.
+ */
+void waitForSocket(int sock, short events, long deadline, char *caller)
+{
+  struct pollfd fd = { sock, events, 0 };
+  int ready;
+  do {
+    long remaining = deadline - nowMs();
+    if (remaining < 0) {
+      remaining = 0;
+    }
+    ready = poll(&fd, 1, remaining);
+  } while (ready < 0 && errno == EINTR);
+
+  if (ready < 0) {
+    close(sock);
+    die("poll()", ErrNetwork);
+  }
+  if (ready == 0) {
+    close(sock);
+    errno = ETIMEDOUT;
+    die(caller, ErrTimeout);
+  }
+}
+
+/**
+ * @brief Resolves the server address.
  *
  * Note: Due to simplicity of this client, this function just exits on error.
  *
- * @param server The hostname or IP of the server.
- * @param port The port number of the server.
- * @returns Open socket.
+ * @param server The hostname or IP of the server, optionally followed by ":port".
+ * @param port The port number of the server unless given in the address.
+ * @returns The address of the server.
  */
-int openConnectionToServer(char *server, int port) 
+struct sockaddr_in resolveServer(char *server, int port)
 {
+  // split off the optional port
+  char host[RECV_BUFFER_SIZE];
+  snprintf(host, sizeof(host), "%s", server);
+  char *colon = strchr(host, ':');
+  if (colon) {
+    *colon = '\0';
+    port = atoi(colon + 1);
+  }
+
   // resolve server hostname
-  struct hostent *hptr = gethostbyname(server);
+  struct hostent *hptr = gethostbyname(host);
   if (!hptr) {
     printf(USAGE);
     die("gethostname()", ErrNetwork);
@@ -82,18 +187,60 @@ int openConnectionToServer(char *server, int port)
   
   // fill in port and the address
   struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
   memcpy(&address.sin_addr, hptr->h_addr_list[0], hptr->h_length);
   address.sin_family = AF_INET;
   address.sin_port = htons(port);
+  return address;
+}
 
-  // contact the server
-  int sock = socket(AF_INET, SOCK_STREAM, 0);
+/**
+ * @brief Returns socket connected to the given address and port.
+ * Resolves the server address and opens a TCP connection, or connects to
+ * a Unix domain socket if the address starts with UNIX_PREFIX.
+ *
+ * Note: Due to simplicity of this client, this function just exits on error.
+ *
+ * @param server The hostname or IP of the server, or "unix:" and the socket path.
+ * @param port The port number of the server, ignored for Unix domain sockets.
+ * @returns Open socket.
+ */
+int openConnectionToServer(char *server, int port) 
+{
+  struct sockaddr_storage address;
+  socklen_t length;
+  if (strncmp(server, UNIX_PREFIX, strlen(UNIX_PREFIX)) == 0) {
+    length = fillUnixAddress(server + strlen(UNIX_PREFIX), (struct sockaddr_un *) &address);
+    if (length == 0) {
+      printf(USAGE);
+      exit(ErrArgs);
+    }
+  }
+  else {
+    struct sockaddr_in inetAddress = resolveServer(server, port);
+    memcpy(&address, &inetAddress, sizeof(inetAddress));
+    length = sizeof(inetAddress);
+  }
+
+  // contact the server, the non-blocking connect allows for a deadline
+  int sock = socket(address.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
   if (sock < 0) {
     die("socket()", ErrNetwork);
   }
-  if (connect(sock, (struct sockaddr *) &address, sizeof(address)) != 0) {
-    close(sock);
-    die("connect()", ErrNetwork);
+  if (connect(sock, (struct sockaddr *) &address, length) != 0) {
+    if (errno != EINPROGRESS) {
+      close(sock);
+      die("connect()", ErrNetwork);
+    }
+    waitForSocket(sock, POLLOUT, nowMs() + CONNECT_TIMEOUT_MS, "connect()");
+
+    int error;
+    socklen_t size = sizeof(error);
+    if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &size) != 0 || error != 0) {
+      close(sock);
+      errno = error;
+      die("connect()", ErrNetwork);
+    }
   }
 
   return sock;
@@ -104,7 +251,7 @@ int openConnectionToServer(char *server, int port)
  * The socket is shutdown for write after the request is sent and then closed after
  * the whole response is received.
  *
- * The response can be of any length.
+ * The response can be of any length, but it must arrive within IO_TIMEOUT_MS.
  * Note: Due to simplicity of this client, this function just exits on error.
  *
  * @param sock The open socket.
@@ -112,11 +259,21 @@ int openConnectionToServer(char *server, int port)
  */
 void processRequest(int sock, char *request) 
 {
+  long deadline = nowMs() + IO_TIMEOUT_MS;
+
   // pass the request
   int requestLength = strlen(request);
-  if (send(sock, request, requestLength, MSG_EOR) != requestLength) {
-    close(sock);
-    die("send()", ErrNetwork);
+  int sent = 0;
+  while (sent < requestLength) {
+    waitForSocket(sock, POLLOUT, deadline, "send()");
+    int size = send(sock, request + sent, requestLength - sent, MSG_EOR | MSG_NOSIGNAL);
+    if (size < 0 && errno != EAGAIN && errno != EINTR) {
+      close(sock);
+      die("send()", ErrNetwork);
+    }
+    if (size > 0) {
+      sent += size;
+    }
   }
   if (shutdown(sock, SHUT_WR) != 0) {
     close(sock);
@@ -126,12 +283,14 @@ void processRequest(int sock, char *request)
   // dump all received data to stdout as a response
   char buffer[RECV_BUFFER_SIZE];
   int size;
-  while ((size = recv(sock, buffer, RECV_BUFFER_SIZE, 0)) > 0) {
-    if (fwrite(buffer, 1, size, stdout) != size) {
+  do {
+    waitForSocket(sock, POLLIN, deadline, "recv()");
+    size = recv(sock, buffer, RECV_BUFFER_SIZE, 0);
+    if (size > 0 && fwrite(buffer, 1, size, stdout) != size) {
       close(sock);
       die("fwrite()", ErrFile);
     }
-  }
+  } while (size > 0 || (size < 0 && (errno == EAGAIN || errno == EINTR)));
   if (size < 0) {
     die("recv()", ErrNetwork);
   }
@@ -139,21 +298,129 @@ void processRequest(int sock, char *request)
   close(sock);
 }
 
+/**
+ * @brief Returns a UDP socket which exchanges datagrams with the given server.
+ *
+ * Note: Due to simplicity of this client, this function just exits on error.
+ *
+ * @param server The hostname or IP of the server.
+ * @param port The port number of the server.
+ * @returns Connected datagram socket.
+ */
+int openDatagramSocket(char *server, int port)
+{
+  struct sockaddr_in address = resolveServer(server, port);
+
+  // connect() only fixes the peer, so stray datagrams from others are ignored
+  int sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+  if (sock < 0) {
+    die("socket()", ErrNetwork);
+  }
+  if (connect(sock, (struct sockaddr *) &address, sizeof(address)) != 0) {
+    close(sock);
+    die("connect()", ErrNetwork);
+  }
+  return sock;
+}
+
+/**
+ * @brief Sends the request as a single datagram, writes the response datagram to stdout.
+ *
+ * There are no retries, the response must arrive within IO_TIMEOUT_MS.
+ * A truncated response datagram is an error.
+ * Note: Due to simplicity of this client, this function just exits on error.
+ *
+ * @param sock The datagram socket.
+ * @param request The request string.
+ */
+void processDatagramRequest(int sock, char *request)
+{
+  long deadline = nowMs() + IO_TIMEOUT_MS;
+
+  int requestLength = strlen(request);
+  if (send(sock, request, requestLength, 0) != requestLength) {
+    close(sock);
+    die("send()", ErrNetwork);
+  }
+
+  static char buffer[DATAGRAM_BUFFER_SIZE];
+  int size;
+  do {
+    waitForSocket(sock, POLLIN, deadline, "recv()");
+    // MSG_TRUNC returns the real length of a datagram longer than the buffer
+    size = recv(sock, buffer, sizeof(buffer), MSG_TRUNC);
+  } while (size < 0 && (errno == EAGAIN || errno == EINTR));
+  if (size < 0) {
+    close(sock);
+    die("recv()", ErrNetwork);
+  }
+  if (size > (int) sizeof(buffer)) {
+    close(sock);
+    fprintf(stderr, "%d: The response datagram of %d bytes was truncated\n", getpid(), size);
+    exit(ErrNetwork);
+  }
+  if (fwrite(buffer, 1, size, stdout) != size) {
+    close(sock);
+    die("fwrite()", ErrFile);
+  }
+  close(sock);
+}
+
+/**
+ * @brief Answers the request from the daemon's shared memory page.
+ *
+ * The output matches the daemon's response, except that the CPU usage is the
+ * daemon's last background sample.
+ * Note: Due to simplicity of this client, this function just exits on error.
+ *
+ * @param name The shared memory object name.
+ * @param request The request string.
+ */
+void processSharedMemoryRequest(char *name, char *request)
+{
+  const struct shmPage *page = shmPageOpen(name);
+  if (!page) {
+    die("shmPageOpen()", ErrFile);
+  }
+  struct shmSnapshot snapshot;
+  if (shmPageRead(page, &snapshot) != 0) {
+    die("shmPageRead()", ErrFile);
+  }
+  shmPageClose(page);
+
+  if (strcmp(request, CMD_CPU) == 0) {
+    printf("Current CPU usage is %d %%\n", (int) ((snapshot.cpuUsagePpm + 5000) / 10000));
+  }
+  else {
+    printf("Current memory usage is %lu kB\n", (unsigned long) snapshot.memoryUsedKb);
+  }
+}
+
 /**
  * @brief Starts the client.
  *
- * @param argc Two arguments are expected.
+ * @param argc Two or three arguments are expected.
  * @param argv The first argument is the host name or IP address of the server,
- *             the second one must be one of the switches specified above.
+ *             optionally followed by the UDP switch, the last one must be one 
+ *             of the request switches specified above.
  */
 int main(int argc, char *argv[]) {
   
   char *server;
   char *request;
+  int udp;
   
-  processArguments(argc, argv, &server, &request);
+  processArguments(argc, argv, &server, &request, &udp);
   
   // process the request
+  if (strncmp(server, SHM_PREFIX, strlen(SHM_PREFIX)) == 0) {
+    processSharedMemoryRequest(server + strlen(SHM_PREFIX), request);
+    return ErrOK;
+  }
+  if (udp) {
+    processDatagramRequest(openDatagramSocket(server, PORT), request);
+    return ErrOK;
+  }
   int sock = openConnectionToServer(server, PORT);
   processRequest(sock, request);
  
@@ -5,11 +5,16 @@
  * @author Karel Dolezal, akwky@centrum.cz
  */
  
+#define _GNU_SOURCE
+
+#include <stdarg.h>
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <time.h>
 
 #include "common.h"
 
@@ -24,3 +29,79 @@ void die(char *caller, enum errorCode code)
   fprintf(stderr, "%d: %s failed. %s\n", getpid(), caller, strerror(errno));
   exit(code);
 }
+
+/**
+ * @brief Returns a monotonic timestamp suitable for computing deadlines.
+ *
+ * @returns Milliseconds since an unspecified point in the past.
+ */
+long nowMs()
+{
+  return clockNs(CLOCK_MONOTONIC) / 1000000;
+}
+
+long long clockNs(clockid_t clock)
+{
+  struct timespec now;
+  clock_gettime(clock, &now);
+  return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/**
+ * @brief Fills in a Unix domain socket address.
+ *
+ * A leading '@' selects the Linux abstract namespace, anything else is a
+ * filesystem path.
+ *
+ * @param path The socket path.
+ * @param address The address to fill in.
+ * @returns The address length for bind() or connect(), 0 if the path is too long.
+ */
+socklen_t fillUnixAddress(const char *path, struct sockaddr_un *address)
+{
+  size_t length = strlen(path);
+  if (length == 0 || length >= sizeof(address->sun_path)) {
+    return 0;
+  }
+
+  memset(address, 0, sizeof(*address));
+  address->sun_family = AF_UNIX;
+  memcpy(address->sun_path, path, length);
+  if (path[0] == '@') {
+    // abstract names are not terminated, their length is given by the address size
+    address->sun_path[0] = '\0';
+    return offsetof(struct sockaddr_un, sun_path) + length;
+  }
+  return offsetof(struct sockaddr_un, sun_path) + length + 1;
+}
+
+/**
+ * @brief Appends formatted text, keeping track of the remaining space.
+ *
+ * The text is cut short if it does not fit, the output stays terminated.
+ *
+ * @param output The buffer.
+ * @param length The current length of the content, updated on return.
+ * @param size The size of the buffer.
+ * @param format The printf() format followed by its arguments.
+ * @returns Zero if the whole text was appended, -1 if it was cut short.
+ */
+int appendFormat(char *output, int *length, int size, const char *format, ...)
+{
+  if (*length > size - 1) {
+    return -1;
+  }
+  va_list args;
+  va_start(args, format);
+  int written = vsnprintf(output + *length, size - *length, format, args);
+  va_end(args);
+  if (written < 0) {
+    return -1;
+  }
+  if (written > size - 1 - *length) {
+    *length = size - 1;
+    return -1;
+  }
+  *length += written;
+  return 0;
+}
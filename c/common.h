@@ -8,12 +8,35 @@
 #ifndef _COMMON_H_
 #define _COMMON_H_
 
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
 // All known commands supported by the server (and client).
 #define CMD_CPU     "cpu\n"
 #define CMD_MEM     "mem\n"
+#define CMD_STATS   "stats\n"
+#define CMD_SESSION "session\n"
+#define CMD_HOSTS   "hosts\n"
+#define CMD_CLUSTER "cluster\n"
+#define CMD_PROFILE "profile\n"
+#define CMD_NODE_CPU "nodecpu\n"
+#define CMD_NODE_MEM "nodemem\n"
+// Alert rules, only within a session: "alert cpu|mem above|below|rise|fall <level> [clear <level>]"
+// and "unalert <id>".
+#define CMD_ALERT   "alert "
+#define CMD_UNALERT "unalert "
+// Prefix of "top <n> cpu|mem", listing the processes using the most of a resource.
+#define CMD_TOP     "top "
+#define CMD_TOP_CPU "top 10 cpu\n"
+#define CMD_TOP_MEM "top 10 mem\n"
 
 #define PORT          5001
 
+// Prefix of a server address selecting a Unix domain socket instead of TCP,
+// e.g. "unix:/run/daemon.sock" or "unix:@daemon" for the abstract namespace.
+#define UNIX_PREFIX   "unix:"
+
 /**
  * Specifies exit codes for the programs. 
  * Only general type of error is reported, see error message in the log for details.
@@ -26,6 +49,7 @@ enum errorCode
   ErrSignal,    // Signal handling
   ErrArgs,      // Invalid command line arguments
   ErrFile,      // File operations like open, fwrite, etc.
+  ErrTimeout,   // A connect, send or receive deadline has expired
 };
 
 /**
@@ -36,4 +60,45 @@ enum errorCode
  */
 void die(char *caller, enum errorCode code);
 
+/**
+ * @brief Returns a monotonic timestamp suitable for computing deadlines.
+ *
+ * @returns Milliseconds since an unspecified point in the past.
+ */
+long nowMs();
+
+/**
+ * @brief Reads a clock with its full resolution, for measuring short intervals.
+ *
+ * @param clock The clock id, e.g. CLOCK_MONOTONIC or CLOCK_THREAD_CPUTIME_ID.
+ * @returns Nanoseconds since the clock's epoch.
+ */
+long long clockNs(clockid_t clock);
+
+/**
+ * @brief Fills in a Unix domain socket address.
+ *
+ * A leading '@' selects the Linux abstract namespace, anything else is a
+ * filesystem path.
+ *
+ * @param path The socket path.
+ * @param address The address to fill in.
+ * @returns The address length for bind() or connect(), 0 if the path is too long.
+ */
+socklen_t fillUnixAddress(const char *path, struct sockaddr_un *address);
+
+/**
+ * @brief Appends formatted text, keeping track of the remaining space.
+ *
+ * The text is cut short if it does not fit, the output stays terminated.
+ *
+ * @param output The buffer.
+ * @param length The current length of the content, updated on return.
+ * @param size The size of the buffer.
+ * @param format The printf() format followed by its arguments.
+ * @returns Zero if the whole text was appended, -1 if it was cut short.
+ */
+int appendFormat(char *output, int *length, int size, const char *format, ...)
+  __attribute__ ((format (printf, 4, 5)));
+
 #endif
\ No newline at end of file
@@ -0,0 +1,84 @@
+/**
+ * @file http.c
+ * @brief Minimal HTTP responder exposing the metrics in the Prometheus text format.
+ *
+ * Only the request line is looked at, headers are ignored. Every response
+ * closes the connection.
+ *
+ * @author Karel Dolezal, akwky@centrum.cz
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+
+#include "common.h"
+#include "http.h"
+#include "metrics.h"
+#include "tasks.h"
+
+// Upper bound for the exposition body
+#define HTTP_BODY_SIZE 2048
+// Prefix of all exported metric names
+#define METRIC_PREFIX "daemon_"
+
+#define HTTP_REQUEST_METRICS "GET " HTTP_METRICS_PATH
+#define HTTP_HEADER_FORMAT \
+  "HTTP/1.1 %s\r\n" \
+  "Content-Type: text/plain; version=0.0.4\r\n" \
+  "Content-Length: %d\r\n" \
+  "Connection: close\r\n" \
+  "\r\n"
+
+/**
+ * @brief Writes the metrics in the text exposition format.
+ *
+ * Only the sampled values are used, so the listening process can answer
+ * without waiting for a measurement.
+ *
+ * @param output The buffer.
+ * @param size The size of the buffer.
+ * @returns The length of the text.
+ */
+int buildExposition(char *output, int size)
+{
+  int length = 0;
+
+  appendFormat(output, &length, size,
+    "# HELP " METRIC_PREFIX "cpu_usage_ratio Total CPU usage over the last sample interval.\n"
+    "# TYPE " METRIC_PREFIX "cpu_usage_ratio gauge\n"
+    METRIC_PREFIX "cpu_usage_ratio %.4f\n", taskGetSampledCpuUsage());
+  appendFormat(output, &length, size,
+    "# HELP " METRIC_PREFIX "memory_used_bytes Memory used, not counting buffers and cache.\n"
+    "# TYPE " METRIC_PREFIX "memory_used_bytes gauge\n"
+    METRIC_PREFIX "memory_used_bytes %ld\n", taskGetSampledMemoryKb() * 1024);
+
+  for (int i = 0; i < MetricCount; i++) {
+    appendFormat(output, &length, size,
+      "# TYPE " METRIC_PREFIX "%s_total counter\n"
+      METRIC_PREFIX "%s_total %lu\n", metricsName(i), metricsName(i), metricsGet(i));
+  }
+  return length;
+}
+
+int httpBuildResponse(const char *request, int size, char *output, int outputSize)
+{
+  static char body[HTTP_BODY_SIZE];
+  int bodyLength = 0;
+  const char *status = "404 Not Found";
+
+  // accept "GET /metrics" followed by a space or a query string
+  int prefix = strlen(HTTP_REQUEST_METRICS);
+  if (size > prefix && strncmp(request, HTTP_REQUEST_METRICS, prefix) == 0 &&
+      (request[prefix] == ' ' || request[prefix] == '?'))
+  {
+    status = "200 OK";
+    bodyLength = buildExposition(body, sizeof(body));
+  }
+
+  int length = 0;
+  appendFormat(output, &length, outputSize, HTTP_HEADER_FORMAT, status, bodyLength);
+  appendFormat(output, &length, outputSize, "%.*s", bodyLength, body);
+  return length;
+}
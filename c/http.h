@@ -0,0 +1,30 @@
+/**
+ * @file http.h
+ * @brief Minimal HTTP responder exposing the metrics in the Prometheus text format.
+ *
+ * @author Karel Dolezal, akwky@centrum.cz
+ */
+
+#ifndef _HTTP_H_
+#define _HTTP_H_
+
+// Path serving the metrics
+#define HTTP_METRICS_PATH "/metrics"
+
+/**
+ * @brief Builds the complete HTTP response for the given request line.
+ *
+ * "GET /metrics" is answered with the text exposition format, anything else
+ * with 404. Nothing is allocated, the response is written into the given buffer.
+ * The usage gauges are the values sampled last, see taskSampleCpu() and
+ * taskSampleMemory().
+ *
+ * @param request The request line (need not be terminated).
+ * @param size The length of the request.
+ * @param output The buffer for the response.
+ * @param outputSize The size of the buffer.
+ * @returns The length of the response, it is cut short if the buffer is too small.
+ */
+int httpBuildResponse(const char *request, int size, char *output, int outputSize);
+
+#endif
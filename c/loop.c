@@ -0,0 +1,219 @@
+/**
+ * @file loop.c
+ * @brief A minimal poll() based event loop with one-shot timers.
+ *
+ * The loop is a process-wide singleton. Watchers are kept in a small fixed
+ * array. Timers start in a table sized for the usual load, which doubles when
+ * it fills up, so a burst of deadlines never leaves a timer unarmed and the
+ * steady state allocates nothing.
+ *
+ * @author Karel Dolezal, akwky@centrum.cz
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "loop.h"
+
+// Maximum number of file descriptors watched at the same time
+#define LOOP_MAX_WATCHERS 256
+// Number of timer slots allocated at first, a deadline per connection and per
+// downstream daemon plus a few periodic timers fit without growing
+#define LOOP_INITIAL_TIMERS 256
+
+struct watcher
+{
+  int fd;                   // -1 when the slot is free
+  short events;
+  loopIoCallback callback;
+  void *data;
+};
+
+struct timer
+{
+  int id;                   // 0 when the slot is free
+  long deadline;            // nowMs() based
+  loopTimerCallback callback;
+  void *data;
+};
+
+static struct watcher watchers[LOOP_MAX_WATCHERS];
+static struct timer *timers = NULL;
+static int timerSlots = 0;
+static int lastTimerId = 0;
+
+void loopInit()
+{
+  for (int i = 0; i < LOOP_MAX_WATCHERS; i++) {
+    watchers[i].fd = -1;
+  }
+  if (!timers) {
+    timers = calloc(LOOP_INITIAL_TIMERS, sizeof(struct timer));
+    if (!timers) {
+      die("calloc()", ErrProcess);
+    }
+    timerSlots = LOOP_INITIAL_TIMERS;
+  }
+  memset(timers, 0, timerSlots * sizeof(struct timer));
+}
+
+/**
+ * @brief Doubles the timer table.
+ *
+ * @returns The index of the first new slot, or -1 if the memory is exhausted.
+ */
+int growTimers()
+{
+  struct timer *grown = realloc(timers, 2 * timerSlots * sizeof(struct timer));
+  if (!grown) {
+    return -1;
+  }
+  memset(grown + timerSlots, 0, timerSlots * sizeof(struct timer));
+  timers = grown;
+  timerSlots *= 2;
+  return timerSlots / 2;
+}
+
+int loopAddFd(int fd, short events, loopIoCallback callback, void *data)
+{
+  for (int i = 0; i < LOOP_MAX_WATCHERS; i++) {
+    if (watchers[i].fd < 0) {
+      watchers[i].fd = fd;
+      watchers[i].events = events;
+      watchers[i].callback = callback;
+      watchers[i].data = data;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+void loopModifyFd(int fd, short events)
+{
+  for (int i = 0; i < LOOP_MAX_WATCHERS; i++) {
+    if (watchers[i].fd == fd) {
+      watchers[i].events = events;
+    }
+  }
+}
+
+void loopRemoveFd(int fd)
+{
+  for (int i = 0; i < LOOP_MAX_WATCHERS; i++) {
+    if (watchers[i].fd == fd) {
+      watchers[i].fd = -1;
+    }
+  }
+}
+
+int loopAddTimer(long timeoutMs, loopTimerCallback callback, void *data)
+{
+  int i = 0;
+  while (i < timerSlots && timers[i].id != 0) {
+    i++;
+  }
+  if (i == timerSlots && (i = growTimers()) < 0) {
+    return -1;
+  }
+
+  // ids are never reused (until overflow), so a stale cancel is harmless
+  if (++lastTimerId <= 0) {
+    lastTimerId = 1;
+  }
+  timers[i].id = lastTimerId;
+  timers[i].deadline = nowMs() + timeoutMs;
+  timers[i].callback = callback;
+  timers[i].data = data;
+  return timers[i].id;
+}
+
+void loopCancelTimer(int id)
+{
+  if (id <= 0) {
+    return;
+  }
+  for (int i = 0; i < timerSlots; i++) {
+    if (timers[i].id == id) {
+      timers[i].id = 0;
+    }
+  }
+}
+
+/**
+ * @brief Fires all expired timers.
+ *
+ * @returns The number of milliseconds until the next deadline, -1 if none is armed.
+ */
+int runTimers()
+{
+  long now = nowMs();
+  for (int i = 0; i < timerSlots; i++) {
+    if (timers[i].id != 0 && timers[i].deadline <= now) {
+      // one-shot: free the slot before the callback so it can re-arm, the
+      // callback may grow (move) the table
+      struct timer expired = timers[i];
+      timers[i].id = 0;
+      expired.callback(expired.data);
+    }
+  }
+
+  // callbacks may have armed new timers, so look for the nearest one afterwards
+  long next = -1;
+  for (int i = 0; i < timerSlots; i++) {
+    if (timers[i].id != 0) {
+      long remaining = timers[i].deadline > now ? timers[i].deadline - now : 0;
+      if (next < 0 || remaining < next) {
+        next = remaining;
+      }
+    }
+  }
+  return (int) next;
+}
+
+void loopRun(volatile sig_atomic_t *interrupt)
+{
+  struct pollfd fds[LOOP_MAX_WATCHERS];
+
+  while (!*interrupt) {
+    int timeout = runTimers();
+
+    // snapshot the watchers, callbacks may modify the table while dispatching
+    int count = 0;
+    for (int i = 0; i < LOOP_MAX_WATCHERS; i++) {
+      if (watchers[i].fd >= 0) {
+        fds[count].fd = watchers[i].fd;
+        fds[count].events = watchers[i].events;
+        fds[count].revents = 0;
+        count++;
+      }
+    }
+    if (count == 0 && timeout < 0) {
+      return;
+    }
+
+    if (poll(fds, count, timeout) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      die("poll()", ErrNetwork);
+    }
+
+    for (int i = 0; i < count; i++) {
+      if (fds[i].revents == 0) {
+        continue;
+      }
+      // the descriptor may have been removed by an earlier callback
+      for (int j = 0; j < LOOP_MAX_WATCHERS; j++) {
+        if (watchers[j].fd == fds[i].fd) {
+          watchers[j].callback(fds[i].fd, fds[i].revents, watchers[j].data);
+          break;
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,88 @@
+/**
+ * @file loop.h
+ * @brief A minimal poll() based event loop with one-shot timers.
+ *
+ * @author Karel Dolezal, akwky@centrum.cz
+ */
+
+#ifndef _LOOP_H_
+#define _LOOP_H_
+
+#include <signal.h>
+
+/**
+ * @brief Called when a watched file descriptor becomes ready.
+ *
+ * @param fd The ready file descriptor.
+ * @param revents The poll() events which occurred.
+ * @param data The pointer passed on registration.
+ */
+typedef void (*loopIoCallback)(int fd, short revents, void *data);
+
+/**
+ * @brief Called when a timer expires.
+ *
+ * @param data The pointer passed on registration.
+ */
+typedef void (*loopTimerCallback)(void *data);
+
+/**
+ * @brief Clears all watchers and timers.
+ *
+ * Must be called before the loop is used and may be called again in a forked
+ * child to drop everything inherited from the parent.
+ */
+void loopInit();
+
+/**
+ * @brief Starts watching a file descriptor.
+ *
+ * @param fd The file descriptor to watch.
+ * @param events The poll() events of interest (POLLIN, POLLOUT).
+ * @param callback The function called when the descriptor is ready.
+ * @param data Passed to the callback as is.
+ * @returns Zero on success, -1 if there is no free watcher slot.
+ */
+int loopAddFd(int fd, short events, loopIoCallback callback, void *data);
+
+/**
+ * @brief Changes the events of interest of a watched file descriptor.
+ *
+ * @param fd The file descriptor.
+ * @param events The new poll() events of interest.
+ */
+void loopModifyFd(int fd, short events);
+
+/**
+ * @brief Stops watching a file descriptor. Unknown descriptors are ignored.
+ *
+ * @param fd The file descriptor.
+ */
+void loopRemoveFd(int fd);
+
+/**
+ * @brief Arms a one-shot timer.
+ *
+ * @param timeoutMs The number of milliseconds from now until the timer fires.
+ * @param callback The function called on expiry.
+ * @param data Passed to the callback as is.
+ * @returns A positive timer id, or -1 if the timer table cannot grow.
+ */
+int loopAddTimer(long timeoutMs, loopTimerCallback callback, void *data);
+
+/**
+ * @brief Disarms a timer. Expired or unknown ids are ignored.
+ *
+ * @param id The timer id returned by loopAddTimer().
+ */
+void loopCancelTimer(int id);
+
+/**
+ * @brief Dispatches events until interrupted or until there is nothing to wait for.
+ *
+ * @param interrupt The loop returns once this flag becomes nonzero (e.g. set by
+ *                  a signal handler).
+ */
+void loopRun(volatile sig_atomic_t *interrupt);
+
+#endif
@@ -0,0 +1,54 @@
+/**
+ * @file metrics.c
+ * @brief Counters describing the daemon's own operation.
+ *
+ * The counters live in an anonymous shared mapping, so the workers forked for
+ * each request update the same values the listening process reports.
+ *
+ * @author Karel Dolezal, akwky@centrum.cz
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "common.h"
+#include "metrics.h"
+
+// Names reported for the counters, indexed by enum metricId
+static const char *names[MetricCount] = {
+  "connections_accepted",
+  "connections_rejected",
+  "requests",
+  "read_timeouts",
+  "write_timeouts",
+  "datagrams",
+  "datagrams_dropped",
+};
+
+static unsigned long *counters = NULL;
+
+void metricsInit()
+{
+  counters = mmap(NULL, sizeof(unsigned long) * MetricCount, PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (counters == MAP_FAILED) {
+    die("mmap()", ErrProcess);
+  }
+}
+
+void metricsIncrement(enum metricId id)
+{
+  __atomic_fetch_add(&counters[id], 1, __ATOMIC_RELAXED);
+}
+
+unsigned long metricsGet(enum metricId id)
+{
+  return __atomic_load_n(&counters[id], __ATOMIC_RELAXED);
+}
+
+const char *metricsName(enum metricId id)
+{
+  return names[id];
+}
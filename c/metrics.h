@@ -0,0 +1,57 @@
+/**
+ * @file metrics.h
+ * @brief Counters describing the daemon's own operation.
+ *
+ * @author Karel Dolezal, akwky@centrum.cz
+ */
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+/**
+ * Identifies a counter. MetricCount must stay the last item.
+ */
+enum metricId
+{
+  MetricConnectionsAccepted = 0,
+  MetricConnectionsRejected,  // Too many connections, workers or sessions
+  MetricRequests,             // Complete requests handed over to a worker
+  MetricReadTimeouts,         // Request not received before the deadline
+  MetricWriteTimeouts,        // Response not sent before the deadline
+  MetricDatagrams,            // Requests received over UDP
+  MetricDatagramsDropped,     // UDP responses which could not be sent
+  MetricCount,
+};
+
+/**
+ * @brief Allocates the counters.
+ *
+ * The counters are placed in memory shared with forked children, so they must
+ * be initialized before the first fork().
+ */
+void metricsInit();
+
+/**
+ * @brief Atomically increments a counter.
+ *
+ * @param id The counter.
+ */
+void metricsIncrement(enum metricId id);
+
+/**
+ * @brief Reads a counter.
+ *
+ * @param id The counter.
+ * @returns The current value.
+ */
+unsigned long metricsGet(enum metricId id);
+
+/**
+ * @brief Returns the name of a counter.
+ *
+ * @param id The counter.
+ * @returns A lower case name with words separated by underscores.
+ */
+const char *metricsName(enum metricId id);
+
+#endif
@@ -0,0 +1,327 @@
+/**
+ * @file numa.c
+ * @brief CPU and memory usage of each NUMA node.
+ *
+ * The nodes and their CPUs are listed in /sys/devices/system/node. Every node
+ * gets a sampler thread running on the CPUs of that node, which periodically
+ * reads the node's meminfo and sums the per-core /proc/stat lines of its CPUs.
+ * The results are published under a mutex, taken around fork() as well so that
+ * the workers inherit a consistent copy.
+ *
+ * @author Karel Dolezal, akwky@centrum.cz
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "numa.h"
+#include "tasks.h"
+
+// Directory listing the NUMA nodes
+#define NODE_DIRECTORY   "/sys/devices/system/node"
+// Size of the line buffer used when reading files
+#define LINE_BUFFER_SIZE 256
+// Note: The format's string length limitation must take into account
+//       the size of the key buffer
+#define NODE_MEMINFO_FORMAT "Node %*d %79s %ld kB"
+#define KEY_BUFFER_SIZE  80
+
+// Interesting keys in the node meminfo, there are no Buffers and Cached lines,
+// FilePages covers both
+#define MEM_KEY_TOTAL    "MemTotal:"
+#define MEM_KEY_FREE     "MemFree:"
+#define MEM_KEY_FILE     "FilePages:"
+
+/**
+ * A NUMA node and its latest sample.
+ */
+struct node
+{
+  int id;
+  cpu_set_t cpus;
+  int cpuCount;
+  pthread_t thread;
+  long intervalMs;
+  // private to the sampler thread
+  long sampleWorking;       // -1 until the first sample
+  long sampleIdle;
+  // published under the lock
+  float cpuUsage;
+  long memoryTotalKb;
+  long memoryUsedKb;
+};
+
+static struct node nodes[NUMA_MAX_NODES];
+static int nodeCount = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Parses a CPU list such as "0-3,8-11".
+ *
+ * @param text The list.
+ * @param cpus The CPUs are added here.
+ * @returns The number of CPUs.
+ */
+int parseCpuList(const char *text, cpu_set_t *cpus)
+{
+  int count = 0;
+
+  while (*text >= '0' && *text <= '9') {
+    char *end;
+    long first = strtol(text, &end, 10), last = first;
+    if (*end == '-') {
+      last = strtol(end + 1, &end, 10);
+    }
+    for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+      CPU_SET(cpu, cpus);
+      count++;
+    }
+    text = *end == ',' ? end + 1 : end;
+  }
+  return count;
+}
+
+/**
+ * @brief Compares the nodes by their number, for qsort().
+ */
+int compareNodes(const void *a, const void *b)
+{
+  return ((const struct node *) a)->id - ((const struct node *) b)->id;
+}
+
+/**
+ * @brief Holds the published values still while the process forks.
+ */
+void lockForFork()
+{
+  pthread_mutex_lock(&lock);
+}
+
+/**
+ * @brief Releases the lock after fork(), in the parent and the child.
+ */
+void unlockAfterFork()
+{
+  pthread_mutex_unlock(&lock);
+}
+
+void numaInit()
+{
+  DIR *directory = opendir(NODE_DIRECTORY);
+  if (!directory) {
+    return;
+  }
+
+  struct dirent *item;
+  int id;
+  while ((item = readdir(directory)) != NULL && nodeCount < NUMA_MAX_NODES) {
+    if (sscanf(item->d_name, "node%d", &id) != 1) {
+      continue;
+    }
+    struct node *n = &nodes[nodeCount];
+    memset(n, 0, sizeof(*n));
+    n->id = id;
+    n->sampleWorking = -1;
+
+    char path[LINE_BUFFER_SIZE];
+    char line[LINE_BUFFER_SIZE];
+    snprintf(path, sizeof(path), NODE_DIRECTORY "/node%d/cpulist", id);
+    FILE *file = fopen(path, "r");
+    if (file) {
+      if (fgets(line, sizeof(line), file)) {
+        n->cpuCount = parseCpuList(line, &n->cpus);
+      }
+      fclose(file);
+    }
+    nodeCount++;
+  }
+  closedir(directory);
+  qsort(nodes, nodeCount, sizeof(nodes[0]), compareNodes);
+
+  pthread_atfork(lockForFork, unlockAfterFork, unlockAfterFork);
+}
+
+/**
+ * @brief Reads the memory usage of a node.
+ *
+ * @param n The node.
+ * @param totalKb The total memory is stored here.
+ * @param usedKb The memory used, not counting the page cache, is stored here.
+ */
+void readNodeMemory(const struct node *n, long *totalKb, long *usedKb)
+{
+  char path[LINE_BUFFER_SIZE];
+  char line[LINE_BUFFER_SIZE];
+  long total = 0, unused = 0, pageCache = 0;
+
+  snprintf(path, sizeof(path), NODE_DIRECTORY "/node%d/meminfo", n->id);
+  FILE *meminfo = fopen(path, "r");
+  if (meminfo) {
+    while (fgets(line, sizeof(line), meminfo)) {
+      char key[KEY_BUFFER_SIZE];
+      long value;
+      if (sscanf(line, NODE_MEMINFO_FORMAT, key, &value) != 2) {
+        continue;
+      }
+      if (strcmp(key, MEM_KEY_TOTAL) == 0) {
+        total = value;
+      }
+      else if (strcmp(key, MEM_KEY_FREE) == 0) {
+        unused = value;
+      }
+      else if (strcmp(key, MEM_KEY_FILE) == 0) {
+        pageCache = value;
+      }
+    }
+    fclose(meminfo);
+  }
+  *totalKb = total;
+  *usedKb = total - unused - pageCache;
+}
+
+void numaReadCpuTimes(const cpu_set_t *cpus, long *timeWorking, long *timeIdle)
+{
+  char path[LINE_BUFFER_SIZE];
+  char line[LINE_BUFFER_SIZE];
+
+  *timeWorking = 0;
+  *timeIdle = 0;
+  snprintf(path, sizeof(path), "%s/stat", taskGetProcRoot());
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    return;
+  }
+  while (fgets(line, sizeof(line), file)) {
+    // the per-core lines follow the total "cpu" line
+    if (strncmp(line, "cpu", 3) != 0) {
+      break;
+    }
+    int cpu;
+    long user, nice, system, idle, iowait, irq, softIrq, steal;
+    if (line[3] < '0' || line[3] > '9' || 
+        sscanf(line, "cpu%d %ld %ld %ld %ld %ld %ld %ld %ld", &cpu, &user, &nice, &system, 
+          &idle, &iowait, &irq, &softIrq, &steal) < 9) 
+    {
+      continue;
+    }
+    if (cpu >= 0 && cpu < CPU_SETSIZE && CPU_ISSET(cpu, cpus)) {
+      *timeWorking += user + nice + system + irq + softIrq + steal;
+      *timeIdle += idle + iowait;
+    }
+  }
+  fclose(file);
+}
+
+/**
+ * @brief Sampler thread of one node.
+ *
+ * @param data The node.
+ * @returns Never returns.
+ */
+void *sampleNode(void *data)
+{
+  struct node *n = (struct node *) data;
+  struct timespec next;
+
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  while (1) {
+    long working, idle, totalKb, usedKb;
+    numaReadCpuTimes(&n->cpus, &working, &idle);
+    readNodeMemory(n, &totalKb, &usedKb);
+
+    pthread_mutex_lock(&lock);
+    long deltaTimeTotal = (working + idle) - (n->sampleWorking + n->sampleIdle);
+    if (n->sampleWorking >= 0 && deltaTimeTotal > 0) {
+      n->cpuUsage = (float) (working - n->sampleWorking) / deltaTimeTotal;
+    }
+    n->memoryTotalKb = totalKb;
+    n->memoryUsedKb = usedKb;
+    pthread_mutex_unlock(&lock);
+    n->sampleWorking = working;
+    n->sampleIdle = idle;
+
+    // keep the period regardless of how long the sampling took
+    next.tv_sec += n->intervalMs / 1000;
+    next.tv_nsec += (n->intervalMs % 1000) * 1000000;
+    if (next.tv_nsec >= 1000000000) {
+      next.tv_sec++;
+      next.tv_nsec -= 1000000000;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+  }
+  return NULL;
+}
+
+void numaStart(long intervalMs)
+{
+  // signals are left to the thread running the event loop
+  sigset_t all, previous;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &previous);
+
+  for (int i = 0; i < nodeCount; i++) {
+    struct node *n = &nodes[i];
+    n->intervalMs = intervalMs;
+
+    // memory-only nodes have no CPUs to run on
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    if (n->cpuCount > 0) {
+      pthread_attr_setaffinity_np(&attributes, sizeof(n->cpus), &n->cpus);
+    }
+    if (pthread_create(&n->thread, &attributes, sampleNode, n) != 0) {
+      printf("%d: Cannot start the sampler of node %d\n", getpid(), n->id);
+    }
+    pthread_attr_destroy(&attributes);
+  }
+  pthread_sigmask(SIG_SETMASK, &previous, NULL);
+  if (nodeCount > 0) {
+    printf("%d: Sampling %d NUMA node(s)\n", getpid(), nodeCount);
+  }
+}
+
+int numaFormatCpu(char *output, int size)
+{
+  int length = 0;
+  int cut = 0;
+
+  output[0] = '\0';
+  pthread_mutex_lock(&lock);
+  for (int i = 0; i < nodeCount; i++) {
+    cut |= appendFormat(output, &length, size, "Node %d CPU usage is %d %%\n", nodes[i].id,
+      (int) (nodes[i].cpuUsage * 100 + 0.5));
+  }
+  pthread_mutex_unlock(&lock);
+  if (nodeCount == 0) {
+    cut |= appendFormat(output, &length, size, "No NUMA nodes\n");
+  }
+  return cut ? -1 : length;
+}
+
+int numaFormatMemory(char *output, int size)
+{
+  int length = 0;
+  int cut = 0;
+
+  output[0] = '\0';
+  pthread_mutex_lock(&lock);
+  for (int i = 0; i < nodeCount; i++) {
+    cut |= appendFormat(output, &length, size, "Node %d memory usage is %ld kB of %ld kB\n",
+      nodes[i].id, nodes[i].memoryUsedKb, nodes[i].memoryTotalKb);
+  }
+  pthread_mutex_unlock(&lock);
+  if (nodeCount == 0) {
+    cut |= appendFormat(output, &length, size, "No NUMA nodes\n");
+  }
+  return cut ? -1 : length;
+}
@@ -0,0 +1,63 @@
+/**
+ * @file numa.h
+ * @brief CPU and memory usage of each NUMA node.
+ *
+ * @author Karel Dolezal, akwky@centrum.cz
+ */
+
+#ifndef _NUMA_H_
+#define _NUMA_H_
+
+#include <sched.h>
+
+// Maximum number of NUMA nodes reported
+#define NUMA_MAX_NODES 64
+
+/**
+ * @brief Finds the NUMA nodes and their CPUs.
+ *
+ * Hosts without NUMA support report no nodes.
+ */
+void numaInit();
+
+/**
+ * @brief Starts one sampler thread per node, pinned to the CPUs of the node.
+ *
+ * Must be called in the process which serves the requests, threads do not
+ * survive fork(). Forked children keep the latest values.
+ *
+ * @param intervalMs The sampling period.
+ */
+void numaStart(long intervalMs);
+
+/**
+ * @brief Writes the CPU usage of each node between its last two samples.
+ *
+ * @param output The buffer.
+ * @param size The size of the buffer.
+ * @returns The length of the text, -1 if it did not fit into the buffer.
+ */
+int numaFormatCpu(char *output, int size);
+
+/**
+ * @brief Writes the used and total memory of each node.
+ *
+ * @param output The buffer.
+ * @param size The size of the buffer.
+ * @returns The length of the text, -1 if it did not fit into the buffer.
+ */
+int numaFormatMemory(char *output, int size);
+
+/**
+ * @brief Sums the CPU times of the given cores from the per-core lines of the
+ * stat file below the proc root.
+ *
+ * Used by the sampler threads, exposed for bench_parse.
+ *
+ * @param cpus The cores.
+ * @param timeWorking The time spent working is stored here, 0 on error.
+ * @param timeIdle The time spent idle is stored here, 0 on error.
+ */
+void numaReadCpuTimes(const cpu_set_t *cpus, long *timeWorking, long *timeIdle);
+
+#endif
@@ -0,0 +1,286 @@
+/**
+ * @file profile.c
+ * @brief Optional hardware counter profiling of the request path.
+ *
+ * Every process opens perf_event_open() counters of its own thread, inherited by
+ * the threads it starts later (e.g. the scan threads of top), and reads them at
+ * every phase boundary. The counts of a thread are added once it is joined. The counters are not grouped, a software
+ * context switch counter in a group does not count on some kernels. The deltas
+ * are summed per request kind in a shared mapping, as the phases after the
+ * request is received run in the forked workers.
+ *
+ * @author Karel Dolezal, akwky@centrum.cz
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "common.h"
+#include "profile.h"
+
+/**
+ * A counter and the software event used when it cannot be opened.
+ */
+struct eventChoice
+{
+  const char *name;
+  uint32_t type;
+  uint64_t config;
+  const char *fallbackName;     // NULL if there is no fallback
+  uint32_t fallbackType;
+  uint64_t fallbackConfig;
+};
+
+// The counters, in the order they are reported
+static const struct eventChoice choices[PROFILE_EVENTS] = {
+  { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,
+    "task_clock_ns", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+  { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,
+    NULL, 0, 0 },
+  { "cache_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES,
+    "page_faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+  { "context_switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES,
+    NULL, 0, 0 },
+};
+
+// Names of the phases, indexed by enum profilePhase
+static const char *phaseNames[PhaseCount] = {
+  "accept",
+  "recv",
+  "dispatch",
+  "task",
+  "format",
+  "send",
+};
+
+/**
+ * Counter sums of one request kind.
+ */
+struct profileTotals
+{
+  unsigned long requests;
+  uint64_t sums[PhaseCount][PROFILE_EVENTS];
+};
+
+// The totals, shared with the workers, NULL if profiling is disabled
+static struct profileTotals *totals = NULL;
+static const char *const *names = NULL;
+static int nameCount = 0;
+
+// The counters of the calling process, -1 if not available
+static int fds[PROFILE_EVENTS] = { -1, -1, -1, -1 };
+static const char *eventNames[PROFILE_EVENTS];  // NULL if not available
+static int reported = 0;
+static int threads = 1;                         // zero if threads are not counted
+
+void profileInit(const char *const *commandNames, int commandCount)
+{
+  totals = mmap(NULL, sizeof(*totals) * PROFILE_MAX_COMMANDS, PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (totals == MAP_FAILED) {
+    die("mmap()", ErrProcess);
+  }
+  names = commandNames;
+  nameCount = commandCount < PROFILE_MAX_COMMANDS ? commandCount : PROFILE_MAX_COMMANDS;
+}
+
+/**
+ * @brief Opens a counter of the calling thread.
+ *
+ * Unprivileged processes may only count user space (perf_event_paranoid),
+ * so a refused counter is retried without the kernel. Kernels before 5.13
+ * refuse inherit_thread, the counter is then retried without the threads.
+ *
+ * @param type The event type.
+ * @param config The event.
+ * @param kernel Nonzero to count the kernel too, set to zero once it is refused.
+ * @param threads Nonzero to count the threads started later too, set to zero
+ *   once it is refused.
+ * @returns The file descriptor, -1 on error.
+ */
+int openEvent(uint32_t type, uint64_t config, int *kernel, int *threads)
+{
+  struct perf_event_attr attributes;
+
+  memset(&attributes, 0, sizeof(attributes));
+  attributes.size = sizeof(attributes);
+  attributes.type = type;
+  attributes.config = config;
+  attributes.exclude_hv = 1;
+  attributes.exclude_kernel = !*kernel;
+  // inherited by new threads, but not by forked processes
+  attributes.inherit = *threads;
+  attributes.inherit_thread = *threads;
+
+  int fd = syscall(SYS_perf_event_open, &attributes, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+  if (fd < 0 && *threads && errno == EINVAL) {
+    attributes.inherit = 0;
+    attributes.inherit_thread = 0;
+    fd = syscall(SYS_perf_event_open, &attributes, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    if (fd >= 0) {
+      *threads = 0;
+    }
+  }
+  if (fd < 0 && *kernel && (errno == EACCES || errno == EPERM)) {
+    attributes.exclude_kernel = 1;
+    fd = syscall(SYS_perf_event_open, &attributes, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    *kernel = 0;
+  }
+  return fd;
+}
+
+void profileOpen()
+{
+  if (!totals) {
+    return;
+  }
+
+  // drop the counters of the parent
+  for (int i = 0; i < PROFILE_EVENTS; i++) {
+    if (fds[i] >= 0) {
+      close(fds[i]);
+    }
+    fds[i] = -1;
+  }
+
+  int kernel = 1, available = 0;
+  for (int i = 0; i < PROFILE_EVENTS; i++) {
+    eventNames[i] = choices[i].name;
+    fds[i] = openEvent(choices[i].type, choices[i].config, &kernel, &threads);
+    if (fds[i] < 0 && choices[i].fallbackName) {
+      eventNames[i] = choices[i].fallbackName;
+      fds[i] = openEvent(choices[i].fallbackType, choices[i].fallbackConfig, &kernel,
+        &threads);
+    }
+    if (fds[i] < 0) {
+      eventNames[i] = NULL;
+      continue;
+    }
+    available++;
+  }
+
+  if (!reported) {
+    reported = 1;
+    printf("%d: Profiling", getpid());
+    for (int i = 0; i < PROFILE_EVENTS; i++) {
+      printf(" %s", eventNames[i] ? eventNames[i] : "-");
+    }
+    printf("%s%s\n", available == 0 ? ", no counters available" :
+                     kernel ? "" : ", user space only",
+           available == 0 || threads ? "" : ", worker threads not counted");
+  }
+}
+
+/**
+ * @brief Reads the current values of all counters.
+ *
+ * @param values The values, zero for the counters not available.
+ */
+void readCounters(uint64_t *values)
+{
+  for (int i = 0; i < PROFILE_EVENTS; i++) {
+    if (fds[i] < 0 || read(fds[i], &values[i], sizeof(values[i])) != sizeof(values[i])) {
+      values[i] = 0;
+    }
+  }
+}
+
+void profileReset(struct profileSample *sample)
+{
+  if (!totals || !sample) {
+    return;
+  }
+  sample->command = -1;
+  memset(sample->deltas, 0, sizeof(sample->deltas));
+  readCounters(sample->last);
+}
+
+void profileStart(struct profileSample *sample)
+{
+  if (totals && sample) {
+    readCounters(sample->last);
+  }
+}
+
+void profileMark(struct profileSample *sample, enum profilePhase phase)
+{
+  uint64_t values[PROFILE_EVENTS];
+
+  if (!totals || !sample) {
+    return;
+  }
+  readCounters(values);
+  for (int i = 0; i < PROFILE_EVENTS; i++) {
+    sample->deltas[phase][i] += values[i] - sample->last[i];
+    sample->last[i] = values[i];
+  }
+}
+
+void profileSetCommand(struct profileSample *sample, int command)
+{
+  if (totals && sample) {
+    sample->command = command;
+  }
+}
+
+void profileRecord(const struct profileSample *sample)
+{
+  if (!totals || !sample || sample->command < 0 || sample->command >= nameCount) {
+    return;
+  }
+  struct profileTotals *t = &totals[sample->command];
+  __atomic_fetch_add(&t->requests, 1, __ATOMIC_RELAXED);
+  for (int phase = 0; phase < PhaseCount; phase++) {
+    for (int i = 0; i < PROFILE_EVENTS; i++) {
+      __atomic_fetch_add(&t->sums[phase][i], sample->deltas[phase][i], __ATOMIC_RELAXED);
+    }
+  }
+}
+
+int profileFormat(char *output, int size)
+{
+  int length = 0;
+  int cut = 0;
+
+  output[0] = '\0';
+  if (!totals) {
+    cut |= appendFormat(output, &length, size, "Profiling is disabled\n");
+    return cut ? -1 : length;
+  }
+
+  cut |= appendFormat(output, &length, size, "events");
+  for (int i = 0; i < PROFILE_EVENTS; i++) {
+    cut |= appendFormat(output, &length, size, " %s", eventNames[i] ? eventNames[i] : "-");
+  }
+  cut |= appendFormat(output, &length, size, ", averages per request\n");
+
+  for (int command = 0; command < nameCount; command++) {
+    unsigned long requests = __atomic_load_n(&totals[command].requests, __ATOMIC_RELAXED);
+    if (requests == 0) {
+      continue;
+    }
+    cut |= appendFormat(output, &length, size, "%s requests %lu\n", names[command], requests);
+    for (int phase = 0; phase < PhaseCount; phase++) {
+      cut |= appendFormat(output, &length, size, "%s %s", names[command], phaseNames[phase]);
+      for (int i = 0; i < PROFILE_EVENTS; i++) {
+        uint64_t sum = __atomic_load_n(&totals[command].sums[phase][i], __ATOMIC_RELAXED);
+        if (eventNames[i]) {
+          cut |= appendFormat(output, &length, size, " %llu", (unsigned long long) (sum / requests));
+        }
+        else {
+          cut |= appendFormat(output, &length, size, " -");
+        }
+      }
+      cut |= appendFormat(output, &length, size, "\n");
+    }
+  }
+  return cut ? -1 : length;
+}
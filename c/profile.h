@@ -0,0 +1,110 @@
+/**
+ * @file profile.h
+ * @brief Optional hardware counter profiling of the request path.
+ *
+ * @author Karel Dolezal, akwky@centrum.cz
+ */
+
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+#include <stdint.h>
+
+// Number of counters read at every phase boundary
+#define PROFILE_EVENTS       4
+// Maximum number of request kinds the totals are kept for
+#define PROFILE_MAX_COMMANDS 16
+
+/**
+ * Phases of serving a request, the counter deltas are attributed to them.
+ */
+enum profilePhase
+{
+  PhaseAccept = 0,    // accept() of the connection
+  PhaseRecv,          // receiving the request
+  PhaseDispatch,      // recognizing the command
+  PhaseTask,          // the measurement done by tasks.c
+  PhaseFormat,        // assembling the response
+  PhaseSend,          // sending the response
+  PhaseCount,
+};
+
+/**
+ * Counter deltas collected while serving one request.
+ */
+struct profileSample
+{
+  int command;                              // request kind, -1 if unknown yet
+  uint64_t last[PROFILE_EVENTS];            // counter values at the last boundary
+  uint64_t deltas[PhaseCount][PROFILE_EVENTS];
+};
+
+/**
+ * @brief Enables profiling and allocates the totals shared with forked children.
+ *
+ * Must be called before the first fork(). Without it all the other functions
+ * do nothing.
+ *
+ * @param commandNames Names of the request kinds, used by profileFormat().
+ * @param commandCount The number of request kinds, at most PROFILE_MAX_COMMANDS.
+ */
+void profileInit(const char *const *commandNames, int commandCount);
+
+/**
+ * @brief Opens the counters of the calling thread.
+ *
+ * The counters include the threads started later, so the threads which should
+ * not be counted must be started before. Hardware events which cannot be
+ * opened (e.g. in a VM) are replaced by software ones. Counters inherited over
+ * fork() count the parent, so a child must call this again.
+ */
+void profileOpen();
+
+/**
+ * @brief Starts a new sample, clearing its deltas.
+ *
+ * @param sample The sample, may be NULL.
+ */
+void profileReset(struct profileSample *sample);
+
+/**
+ * @brief Marks the beginning of a phase, the counters are read.
+ *
+ * @param sample The sample, may be NULL.
+ */
+void profileStart(struct profileSample *sample);
+
+/**
+ * @brief Marks the end of a phase, the counter deltas since the last boundary
+ * are added to it.
+ *
+ * @param sample The sample, may be NULL.
+ * @param phase The phase which has just ended.
+ */
+void profileMark(struct profileSample *sample, enum profilePhase phase);
+
+/**
+ * @brief Sets the request kind the sample is accounted to.
+ *
+ * @param sample The sample, may be NULL.
+ * @param command The request kind, an index into the names given to profileInit().
+ */
+void profileSetCommand(struct profileSample *sample, int command);
+
+/**
+ * @brief Adds a finished sample to the totals of its request kind.
+ *
+ * @param sample The sample, may be NULL.
+ */
+void profileRecord(const struct profileSample *sample);
+
+/**
+ * @brief Writes the average counter deltas per request kind and phase.
+ *
+ * @param output The buffer.
+ * @param size The size of the buffer.
+ * @returns The length of the text, -1 if it did not fit into the buffer.
+ */
+int profileFormat(char *output, int size);
+
+#endif
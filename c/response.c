@@ -0,0 +1,285 @@
+/**
+ * @file response.c
+ * @brief Assembles responses from fragments sent by a single sendmsg().
+ *
+ * Integers are formatted two digits at a time from a table, from the end, with
+ * a single division by 100 per pair. Whatever is written into the scratch area
+ * one piece after another ends up in a single fragment. Short fragments are
+ * copied there because every gather entry costs sendmsg() about as much as
+ * copying a few dozen bytes: a "stats" response of 28 referenced fragments
+ * took three times longer to send than the same bytes in one piece.
+ *
+ * @author Karel Dolezal, akwky@centrum.cz
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <sys/socket.h>
+
+#include "common.h"
+#include "metrics.h"
+#include "response.h"
+
+// Maximum number of decimals of responseAddFixed()
+#define MAX_DECIMALS 6
+
+// Decimal representations of 0 to 99, two characters each
+static const char digitPairs[] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+  "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+static const long powersOf10[MAX_DECIMALS + 1] = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+
+// Written instead of numbers which cannot be formatted
+static const struct iovec notANumber = RESPONSE_FRAGMENT("nan");
+
+// Constant parts of the responses, sent as they are
+static const struct iovec fragmentCpuPrefix = RESPONSE_FRAGMENT("Current CPU usage is ");
+static const struct iovec fragmentCpuSuffix = RESPONSE_FRAGMENT(" %\n");
+static const struct iovec fragmentMemPrefix = RESPONSE_FRAGMENT("Current memory usage is ");
+static const struct iovec fragmentMemSuffix = RESPONSE_FRAGMENT(" kB\n");
+static const struct iovec fragmentSpace = RESPONSE_FRAGMENT(" ");
+static const struct iovec fragmentNewline = RESPONSE_FRAGMENT("\n");
+
+/**
+ * @brief Formats an unsigned integer in decimal.
+ *
+ * @param output At least RESPONSE_MAX_DIGITS bytes, not terminated.
+ * @param value The value.
+ * @returns The number of characters written.
+ */
+int formatUnsigned(char *output, unsigned long value)
+{
+  char digits[RESPONSE_MAX_DIGITS];
+  char *start = digits + RESPONSE_MAX_DIGITS;
+
+  while (value >= 100) {
+    unsigned long pair = value % 100;
+    value /= 100;
+    start -= 2;
+    memcpy(start, digitPairs + pair * 2, 2);
+  }
+  if (value >= 10) {
+    start -= 2;
+    memcpy(start, digitPairs + value * 2, 2);
+  }
+  else {
+    *--start = '0' + value;
+  }
+
+  int length = digits + RESPONSE_MAX_DIGITS - start;
+  memcpy(output, start, length);
+  return length;
+}
+
+int responseFormatLong(char *output, long value)
+{
+  if (value < 0) {
+    output[0] = '-';
+    return 1 + formatUnsigned(output + 1, -(unsigned long) value);
+  }
+  return formatUnsigned(output, value);
+}
+
+void responseInit(struct response *r, char *text, int textSize)
+{
+  r->count = 0;
+  r->length = 0;
+  r->first = 0;
+  r->sent = 0;
+  r->text = text;
+  r->textSize = textSize;
+  r->scratchUsed = 0;
+  r->overflow = 0;
+}
+
+/**
+ * @brief Appends a fragment referencing the data, the response overflows if
+ * there is no fragment left.
+ *
+ * @param r The response.
+ * @param data The data.
+ * @param length The length of the data.
+ */
+void addFragment(struct response *r, const char *data, int length)
+{
+  if (length <= 0) {
+    return;
+  }
+  if (r->count == RESPONSE_MAX_FRAGMENTS) {
+    r->overflow = 1;
+    return;
+  }
+  r->fragments[r->count].iov_base = (void *) data;
+  r->fragments[r->count].iov_len = length;
+  r->count++;
+  r->length += length;
+}
+
+/**
+ * @brief Appends the characters just written at the end of the scratch area.
+ *
+ * @param r The response.
+ * @param length The number of characters.
+ */
+void addScratch(struct response *r, int length)
+{
+  char *start = r->scratch + r->scratchUsed;
+  struct iovec *last = r->count > 0 ? &r->fragments[r->count - 1] : NULL;
+
+  r->scratchUsed += length;
+  if (last && (char *) last->iov_base + last->iov_len == start) {
+    last->iov_len += length;
+    r->length += length;
+  }
+  else {
+    addFragment(r, start, length);
+  }
+}
+
+void responseAddText(struct response *r, const char *text, int length)
+{
+  if (length <= RESPONSE_COPY_LIMIT && length <= RESPONSE_SCRATCH_SIZE - r->scratchUsed) {
+    memcpy(r->scratch + r->scratchUsed, text, length);
+    addScratch(r, length);
+  }
+  else {
+    addFragment(r, text, length);
+  }
+}
+
+void responseAddFormatted(struct response *r, int length)
+{
+  if (length < 0) {
+    r->overflow = 1;
+    return;
+  }
+  responseAddText(r, r->text, length);
+}
+
+void responseAdd(struct response *r, const struct iovec *fragment)
+{
+  responseAddText(r, fragment->iov_base, fragment->iov_len);
+}
+
+void responseAddLong(struct response *r, long value)
+{
+  if (RESPONSE_SCRATCH_SIZE - r->scratchUsed < RESPONSE_MAX_DIGITS) {
+    r->overflow = 1;
+    return;
+  }
+  addScratch(r, responseFormatLong(r->scratch + r->scratchUsed, value));
+}
+
+void responseAddFixed(struct response *r, double value, int decimals)
+{
+  char *output = r->scratch + r->scratchUsed;
+  int length = 0;
+
+  if (RESPONSE_SCRATCH_SIZE - r->scratchUsed < RESPONSE_MAX_DIGITS + 1 + MAX_DECIMALS) {
+    r->overflow = 1;
+    return;
+  }
+  decimals = decimals < 0 ? 0 : decimals > MAX_DECIMALS ? MAX_DECIMALS : decimals;
+
+  // rounded half away from zero, NAN fails both comparisons
+  double scaled = value * powersOf10[decimals];
+  if (!(scaled > -9e18 && scaled < 9e18)) {
+    responseAdd(r, &notANumber);
+    return;
+  }
+  long rounded = (long) (scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+  unsigned long magnitude = rounded < 0 ? -(unsigned long) rounded : (unsigned long) rounded;
+  if (rounded < 0) {
+    output[length++] = '-';
+  }
+  length += formatUnsigned(output + length, magnitude / powersOf10[decimals]);
+  if (decimals > 0) {
+    unsigned long fraction = magnitude % powersOf10[decimals];
+    output[length++] = '.';
+    for (int i = decimals - 1; i >= 0; i--) {
+      output[length + i] = '0' + fraction % 10;
+      fraction /= 10;
+    }
+    length += decimals;
+  }
+  addScratch(r, length);
+}
+
+void responseCpuUsage(struct response *r, float usage)
+{
+  responseAdd(r, &fragmentCpuPrefix);
+  responseAddFixed(r, usage * 100, 0);
+  responseAdd(r, &fragmentCpuSuffix);
+}
+
+void responseMemoryUsage(struct response *r, long usedKb)
+{
+  responseAdd(r, &fragmentMemPrefix);
+  responseAddLong(r, usedKb);
+  responseAdd(r, &fragmentMemSuffix);
+}
+
+void responseCounters(struct response *r)
+{
+  for (int i = 0; i < MetricCount; i++) {
+    const char *name = metricsName(i);
+    responseAddText(r, name, strlen(name));
+    responseAdd(r, &fragmentSpace);
+    responseAddLong(r, metricsGet(i));
+    responseAdd(r, &fragmentNewline);
+  }
+}
+
+int responseCopy(const struct response *r, char *output, int size)
+{
+  int length = 0;
+  for (int i = r->first; i < r->count && length < size; i++) {
+    int copy = r->fragments[i].iov_len;
+    if (copy > size - length) {
+      copy = size - length;
+    }
+    memcpy(output + length, r->fragments[i].iov_base, copy);
+    length += copy;
+  }
+  return length;
+}
+
+int responseSend(struct response *r, int socket, int flags)
+{
+  int size;
+
+  // send() of a single fragment skips setting up the gather list
+  if (r->count - r->first == 1) {
+    size = send(socket, r->fragments[r->first].iov_base, r->fragments[r->first].iov_len, flags);
+  }
+  else {
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = r->fragments + r->first;
+    message.msg_iovlen = r->count - r->first;
+    size = sendmsg(socket, &message, flags);
+  }
+  if (size <= 0) {
+    return size;
+  }
+
+  // skip the fragments sent completely, shorten the one sent partially
+  r->sent += size;
+  int left = size;
+  while (left > 0) {
+    struct iovec *fragment = &r->fragments[r->first];
+    if (left >= (int) fragment->iov_len) {
+      left -= fragment->iov_len;
+      r->first++;
+    }
+    else {
+      fragment->iov_base = (char *) fragment->iov_base + left;
+      fragment->iov_len -= left;
+      left = 0;
+    }
+  }
+  return size;
+}
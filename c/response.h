@@ -0,0 +1,161 @@
+/**
+ * @file response.h
+ * @brief Assembles responses from fragments sent by a single sendmsg().
+ *
+ * Numbers are formatted into a small scratch area of the response, short
+ * constant parts are copied next to them. Long constant parts and the text
+ * formatted as a whole into the buffer given to responseInit() are referenced
+ * where they are. A response which does not fit is marked as overflowed
+ * instead of being cut short silently, including text formatted by
+ * appendFormat() which was cut short, see responseAddFormatted().
+ *
+ * The "cpu", "mem" and "stats" responses of the server are built here as well,
+ * so that bench_format measures the very same code.
+ * @author Karel Dolezal, akwky@centrum.cz
+ */
+
+#ifndef _RESPONSE_H_
+#define _RESPONSE_H_
+
+#include <sys/uio.h>
+
+// Maximum number of fragments of one response, further fragments overflow it
+#define RESPONSE_MAX_FRAGMENTS 64
+// Size of the scratch area for the formatted numbers of one response
+#define RESPONSE_SCRATCH_SIZE  512
+// Fragments up to this length are copied into the scratch area instead, next
+// to the numbers, a gather entry costs sendmsg() more than copying a few bytes
+#define RESPONSE_COPY_LIMIT    64
+// Maximum length of a formatted integer, "-9223372036854775808"
+#define RESPONSE_MAX_DIGITS    20
+
+/**
+ * Initializes a fragment referencing a string literal, the length is computed
+ * by the compiler.
+ */
+#define RESPONSE_FRAGMENT(text) { (void *) (text), sizeof(text) - 1 }
+
+/**
+ * A response being assembled or sent.
+ */
+struct response
+{
+  struct iovec fragments[RESPONSE_MAX_FRAGMENTS];
+  int count;                  // number of fragments used
+  int length;                 // total length of the fragments
+  int first;                  // the first fragment not sent completely
+  int sent;                   // number of bytes sent
+  char *text;                 // buffer for the text formatted as a whole
+  int textSize;
+  int scratchUsed;
+  int overflow;               // nonzero if something did not fit, the response is incomplete
+  char scratch[RESPONSE_SCRATCH_SIZE];
+};
+
+/**
+ * @brief Empties the response and clears its overflow flag.
+ *
+ * @param r The response.
+ * @param text The buffer for text formatted as a whole, see responseAddText().
+ * @param textSize The size of the buffer.
+ */
+void responseInit(struct response *r, char *text, int textSize);
+
+/**
+ * @brief Appends a constant fragment, which must outlive the response.
+ *
+ * @param r The response.
+ * @param fragment The fragment, see RESPONSE_FRAGMENT().
+ */
+void responseAdd(struct response *r, const struct iovec *fragment);
+
+/**
+ * @brief Appends text which must stay unchanged until the response is sent,
+ * usually formatted into the text buffer of the response.
+ *
+ * @param r The response.
+ * @param text The text.
+ * @param length The length of the text.
+ */
+void responseAddText(struct response *r, const char *text, int length);
+
+/**
+ * @brief Appends the text formatted into the text buffer of the response.
+ *
+ * @param r The response.
+ * @param length The length of the text, or -1 if it did not fit into the text
+ *               buffer, which overflows the response.
+ */
+void responseAddFormatted(struct response *r, int length);
+
+/**
+ * @brief Appends an integer in decimal, the response overflows if there is no
+ * room left in its scratch area.
+ *
+ * @param r The response.
+ * @param value The value.
+ */
+void responseAddLong(struct response *r, long value);
+
+/**
+ * @brief Appends a number rounded to a fixed number of decimals, like "%.*f".
+ *
+ * @param r The response.
+ * @param value The value, its scaled magnitude must fit into a long.
+ * @param decimals The number of decimals, 0 to 6.
+ */
+void responseAddFixed(struct response *r, double value, int decimals);
+
+/**
+ * @brief Copies the fragments into a contiguous buffer, truncating them.
+ *
+ * @param r The response.
+ * @param output The buffer, not terminated.
+ * @param size The size of the buffer.
+ * @returns The number of bytes copied.
+ */
+int responseCopy(const struct response *r, char *output, int size);
+
+/**
+ * @brief Sends as much of the rest of the response as the socket accepts.
+ *
+ * @param r The response, the sent part is skipped the next time.
+ * @param socket The socket.
+ * @param flags The flags of sendmsg().
+ * @returns The result of sendmsg().
+ */
+int responseSend(struct response *r, int socket, int flags);
+
+/**
+ * @brief Appends the answer to the "cpu" command.
+ *
+ * @param r The response.
+ * @param usage The CPU usage in the range 0 - 1.0.
+ */
+void responseCpuUsage(struct response *r, float usage);
+
+/**
+ * @brief Appends the answer to the "mem" command.
+ *
+ * @param r The response.
+ * @param usedKb The number of kB used.
+ */
+void responseMemoryUsage(struct response *r, long usedKb);
+
+/**
+ * @brief Appends the answer to the "stats" command, a line per counter.
+ *
+ * @param r The response.
+ */
+void responseCounters(struct response *r);
+
+/**
+ * @brief Formats an integer in decimal.
+ *
+ * @param output At least RESPONSE_MAX_DIGITS bytes, not terminated.
+ * @param value The value.
+ * @returns The number of characters written.
+ */
+int responseFormatLong(char *output, long value);
+
+#endif
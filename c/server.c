@@ -11,7 +11,7 @@
  * @author Karel Dolezal, akwky@centrum.cz
  */
 
-#define _POSIX_SOURCE 
+#define _GNU_SOURCE
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -24,25 +24,179 @@
 #include <sys/stat.h>
 #include <sys/wait.h> 
 #include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
 
 #include "common.h"
+#include "aggregator.h"
+#include "alerts.h"
+#include "http.h"
+#include "loop.h"
+#include "metrics.h"
+#include "numa.h"
+#include "profile.h"
+#include "response.h"
+#include "shmpage.h"
 #include "tasks.h"
+#include "top.h"
+#include "trace.h"
 
 
 // The buffer size for new TCP connections listen()
 #define BACKLOG_SIZE   3
-// Data buffer size for TCP communication. Used for both receive and send.
-// The entire request/response content must fit into this buffer.
+// Receive buffer size for TCP and UDP communication.
+// The entire request content must fit into this buffer.
 #define BUFFER_SIZE   80
+// Size of the response buffer, large enough for the "stats" and "hosts" responses.
+#define RESPONSE_BUFFER_SIZE 4096
+// Size of the buffer for responses not sent yet within a session.
+#define SESSION_OUTPUT_SIZE  (2 * RESPONSE_BUFFER_SIZE)
+// Size of the chunks in which HTTP request headers are read and skipped.
+#define HTTP_CHUNK_SIZE  512
+// Maximum number of listening sockets.
+#define MAX_LISTENERS    4
+// Maximum number of datagrams received or sent by one system call.
+#define UDP_BATCH_SIZE   16
+// Maximum number of connections waiting for a complete request.
+#define MAX_CONNECTIONS  64
+// Maximum number of sessions, below MAX_CONNECTIONS so that the sessions never
+// take every slot.
+#define MAX_SESSIONS     (MAX_CONNECTIONS / 2)
+// Maximum number of worker processes serving requests at the same time.
+#define MAX_WORKERS      32
+// Deadline for receiving the complete request, counted from accept().
+#define READ_TIMEOUT_MS  5000
+// Deadline for sending the complete response, counted from the request.
+#define WRITE_TIMEOUT_MS 5000
+// A session without any request for this long is closed.
+#define SESSION_IDLE_TIMEOUT_MS 60000
+// Period of the background CPU usage sampling.
+#define CPU_SAMPLE_INTERVAL_MS 1000
 // Default response for unknown requests.
 #define RESPONSE_INVALID_REQUEST "Invalid request\n"
+// Response for commands which need a persistent connection.
+#define RESPONSE_NEEDS_SESSION "Alerts need a session\n"
+// Response for commands too slow to be served without a worker.
+#define RESPONSE_NEEDS_WORKER "Not available in this mode\n"
+// Response replacing one which did not fit into the response buffers.
+#define RESPONSE_TOO_LONG "Response too long\n"
+// Response for sessions refused because MAX_SESSIONS are open.
+#define RESPONSE_TOO_MANY_SESSIONS "Too many sessions\n"
+// Response for requests refused because too many workers are running.
+#define RESPONSE_BUSY "Server busy\n"
+
+// Constant parts of the responses, sent as they are
+const struct iovec fragmentInvalid = RESPONSE_FRAGMENT(RESPONSE_INVALID_REQUEST);
+const struct iovec fragmentNeedsSession = RESPONSE_FRAGMENT(RESPONSE_NEEDS_SESSION);
+const struct iovec fragmentNeedsWorker = RESPONSE_FRAGMENT(RESPONSE_NEEDS_WORKER);
+const struct iovec fragmentTooLong = RESPONSE_FRAGMENT(RESPONSE_TOO_LONG);
 
 // Path to the log file
 #define LOG_FILE "server.log"
 
+// Help text displayed in case of invalid arguments are specified.
+#define USAGE "Usage: server [-p <port>] [-u] [-H <http port>] [-U </path | @name>] [-S </shm name>]" \
+  " [-A <host[:port]>,...] [-P] [-R </proc root>] [-T </trace file>]\n"
+#define OPTION_PORT      "-p"
+#define OPTION_HTTP_PORT "-H"
+#define OPTION_UDP       "-u"
+#define OPTION_UNIX      "-U"
+#define OPTION_SHM       "-S"
+#define OPTION_AGGREGATE "-A"
+#define OPTION_PROFILE   "-P"
+#define OPTION_PROC_ROOT "-R"
+#define OPTION_TRACE     "-T"
+
+/**
+ * Protocols spoken on the listening sockets.
+ */
+enum protocol
+{
+  ProtocolLine = 0,   // Single line commands defined in common.h
+  ProtocolHttp,       // HTTP GET of the Prometheus metrics
+  ProtocolUdp,        // The line protocol, one datagram per request and response
+};
+
+/**
+ * Request kinds the profile is kept for, see requestNames.
+ */
+enum requestKind
+{
+  RequestCpu = 0,
+  RequestMem,
+  RequestStats,
+  RequestHosts,
+  RequestCluster,
+  RequestTop,
+  RequestProfile,
+  RequestNodeCpu,
+  RequestNodeMem,
+  RequestHttp,
+  RequestInvalid,
+  RequestKindCount,
+};
+
+// Names reported by the profile, indexed by enum requestKind
+const char *const requestNames[RequestKindCount] = {
+  "cpu",
+  "mem",
+  "stats",
+  "hosts",
+  "cluster",
+  "top",
+  "profile",
+  "nodecpu",
+  "nodemem",
+  "http",
+  "invalid",
+};
+
+/**
+ * A listening socket.
+ */
+struct listener
+{
+  int socket;
+  enum protocol protocol;
+};
+
+/**
+ * State of a client connection, from accept() until the response is sent.
+ *
+ * A line protocol connection may turn into a session (see CMD_SESSION), which
+ * stays open and is served by the listening process itself.
+ */
+struct connection
+{
+  int socket;                 // -1 when the slot is free
+  enum protocol protocol;
+  int timer;                  // the pending deadline
+  int size;                   // number of request bytes received
+  int headerEnd;              // HTTP only: number of matched "\r\n\r\n" characters
+  int session;                // nonzero once the connection is a session
+  int lineDeadline;           // session only: nonzero while a partial line has a deadline
+  char buffer[BUFFER_SIZE];
+  char output[SESSION_OUTPUT_SIZE];   // session: responses not sent yet, HTTP: the response
+  int outputSize;
+  struct response response;   // worker and HTTP: the response being sent
+  struct profileSample profile;       // only if profiling is enabled
+  struct sockaddr_storage peer;       // the client address, for the trace
+};
 
 // This variable is set by a signal handler.
-int signalCaught = 0;
+volatile sig_atomic_t signalCaught = 0;
+// Number of open sessions, see MAX_SESSIONS
+int sessionCount = 0;
+// Number of worker processes not reaped yet, changed with SIGCHLD blocked
+volatile sig_atomic_t workerCount = 0;
+
+// The listening sockets.
+struct listener listeners[MAX_LISTENERS];
+int listenerCount = 0;
+// Connections waiting for a complete request.
+struct connection connections[MAX_CONNECTIONS];
+// The shared memory page receiving the samples, NULL if not requested.
+struct shmPage *metricsPage = NULL;
 
 /**
  * @brief Signal handler for stopping the daemon nicely.
@@ -55,6 +209,20 @@ void sigIntHandler(int signal)
   signalCaught = 1;
 }
 
+/**
+ * @brief Signal handler reaping the finished workers.
+ *
+ * @param signal This value is ignored
+ */
+void sigChldHandler(int signal)
+{
+  int savedErrno = errno;
+  while (waitpid(-1, NULL, WNOHANG) > 0) {
+    workerCount--;
+  }
+  errno = savedErrno;
+}
+
 /**
  * @brief Switches the process to background
  *
@@ -111,63 +279,809 @@ void runAsDaemon()
 }
 
 /**
- * @brief Serves a request on the given socket.
+ * @brief Closes a connection and releases its slot.
  *
- * Reads the request string and performs a desired operation. Then sends 
- * back a response and terminates the connection.
+ * @param conn The connection.
+ */
+void closeConnection(struct connection *conn)
+{
+  if (conn->session) {
+    alertsRemoveOwner(conn);
+    sessionCount--;
+    conn->session = 0;
+  }
+  loopRemoveFd(conn->socket);
+  loopCancelTimer(conn->timer);
+  close(conn->socket);
+  conn->socket = -1;
+  conn->timer = -1;
+}
+
+/**
+ * @brief Arms the deadline of a connection. A connection which would have no
+ * deadline is closed instead.
  *
- * @param socket The open socket to the client.
+ * @param conn The connection.
+ * @param timeoutMs The deadline, in milliseconds from now.
+ * @param callback Called when the deadline passes.
+ * @returns Nonzero if the deadline is armed, zero if the connection is closed.
  */
-void processRequest(int socket) 
+int armDeadline(struct connection *conn, long timeoutMs, loopTimerCallback callback)
 {
-  char buffer[BUFFER_SIZE];
-  int size;
-  
-  // read the request
-  size = recv(socket, &buffer, sizeof(buffer), 0);
+  conn->timer = loopAddTimer(timeoutMs, callback, conn);
+  if (conn->timer < 0) {
+    printf("%d: Cannot arm a deadline, closing connection\n", getpid());
+    closeConnection(conn);
+    return 0;
+  }
+  return 1;
+}
+
+/**
+ * @brief Drops a client which did not take the response in time.
+ *
+ * @param data The connection.
+ */
+void onWriteTimeout(void *data)
+{
+  printf("%d: Response not sent in time, closing connection\n", getpid());
+  metricsIncrement(MetricWriteTimeouts);
+  closeConnection((struct connection *) data);
+}
+
+/**
+ * @brief Sends as much of the pending response as the socket accepts.
+ * The connection is closed once the whole response is sent.
+ *
+ * @param socket The connection socket.
+ * @param revents Ignored, errors are reported by sendmsg().
+ * @param data The connection.
+ */
+void onWritable(int socket, short revents, void *data)
+{
+  struct connection *conn = (struct connection *) data;
+
+  profileStart(&conn->profile);
+  int size = responseSend(&conn->response, socket, MSG_EOR | MSG_NOSIGNAL);
   if (size < 0) {
-    die("recv()", ErrNetwork);
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+      return;
+    }
+    printf("%d: sendmsg() failed, closing connection. %s\n", getpid(), strerror(errno));
+    closeConnection(conn);
+    return;
   }
-  shutdown(socket, SHUT_RD);
+  profileMark(&conn->profile, PhaseSend);
   
+  if (conn->response.sent == conn->response.length) {
+    profileRecord(&conn->profile);
+    shutdown(socket, SHUT_WR);
+    closeConnection(conn);
+  }
+}
 
-  // perform the requested task
-  char *response = RESPONSE_INVALID_REQUEST;
-  if (strncmp(buffer, CMD_CPU, strlen(CMD_CPU)) == 0) {
-    printf("%d: Recognized CPU request\n", getpid());
-    sprintf(buffer, "Current CPU usage is %d %%\n", (int) (taskGetCpuUsage() * 100 + 0.5));
-    response = buffer;
+/**
+ * @brief Lists the processes using the most of a resource, "top <n> cpu|mem".
+ *
+ * @param request The request, need not be terminated.
+ * @param response The response, the lines are formatted into its text buffer.
+ * @param profile The sample the time of the scan is attributed to, may be NULL.
+ */
+void processTop(const char *request, struct response *response, struct profileSample *profile)
+{
+  struct topEntry entries[TOP_MAX_COUNT];
+  char line[BUFFER_SIZE + 1];
+  char resource[4];
+  int count, length = 0, cut = 0;
+
+  // requests are at most BUFFER_SIZE long, terminate a copy for sscanf()
+  snprintf(line, sizeof(line), "%.*s", BUFFER_SIZE, request);
+  int valid = sscanf(line, CMD_TOP "%d %3[a-z]", &count, resource) == 2 && count >= 1 && 
+    count <= TOP_MAX_COUNT && (strcmp(resource, "cpu") == 0 || strcmp(resource, "mem") == 0);
+  profileMark(profile, PhaseDispatch);
+  if (!valid) {
+    responseAdd(response, &fragmentInvalid);
+    return;
+  }
+
+  count = topScan(strcmp(resource, "cpu") == 0 ? TopByCpu : TopByMemory, count, entries);
+  profileMark(profile, PhaseTask);
+  if (count < 0) {
+    cut |= appendFormat(response->text, &length, response->textSize, "Cannot list processes\n");
   }
-  if (strncmp(buffer, CMD_MEM, strlen(CMD_MEM)) == 0) {
-    printf("%d: Recognized MEM request\n", getpid());
-    sprintf(buffer, "Current memory usage is %ld kB\n", taskGetUsedMemoryKb());
-    response = buffer;
+  for (int i = 0; i < count; i++) {
+    cut |= appendFormat(response->text, &length, response->textSize, 
+      "%d %s cpu %.1f %% mem %ld kB\n", 
+      entries[i].pid, entries[i].name, entries[i].cpuPercent, entries[i].memoryKb);
   }
+  responseAddFormatted(response, cut ? -1 : length);
+}
 
-  // send the response and close connection
-  size = strlen(response);
-  if (send(socket, response, size, MSG_EOR) != size) {
-    die("send()", ErrNetwork);
+/**
+ * @brief Replaces a response which does not fit by RESPONSE_TOO_LONG.
+ *
+ * @param response The response.
+ */
+void replaceTooLong(struct response *response)
+{
+  printf("%d: Response too long, not sent\n", getpid());
+  responseInit(response, response->text, response->textSize);
+  responseAdd(response, &fragmentTooLong);
+}
+
+/**
+ * @brief Performs a command of the line protocol.
+ *
+ * Responses made of fixed text and numbers are assembled from fragments, the
+ * longer ones are formatted as a whole into the text buffer of the response.
+ * A response which did not fit is replaced by RESPONSE_TOO_LONG rather than
+ * sent incomplete.
+ *
+ * @param request The request, need not be terminated.
+ * @param response The response, initialized.
+ * @param nonBlocking Nonzero when serving in the listening process: the
+ *                    background CPU sample is reported instead of measuring
+ *                    and commands which take long are refused.
+ * @param profile The sample the time of the task is attributed to, may be NULL.
+ */
+void processCommand(const char *request, struct response *response, int nonBlocking,
+  struct profileSample *profile)
+{
+  if (strncmp(request, CMD_CPU, strlen(CMD_CPU)) == 0) {
+    profileSetCommand(profile, RequestCpu);
+    profileMark(profile, PhaseDispatch);
+    float usage = nonBlocking ? taskGetSampledCpuUsage() : taskGetCpuUsage();
+    profileMark(profile, PhaseTask);
+    responseCpuUsage(response, usage);
+  }
+  else if (strncmp(request, CMD_MEM, strlen(CMD_MEM)) == 0) {
+    profileSetCommand(profile, RequestMem);
+    profileMark(profile, PhaseDispatch);
+    long usedKb = taskGetUsedMemoryKb();
+    profileMark(profile, PhaseTask);
+    responseMemoryUsage(response, usedKb);
+  }
+  else if (strncmp(request, CMD_STATS, strlen(CMD_STATS)) == 0) {
+    profileSetCommand(profile, RequestStats);
+    profileMark(profile, PhaseDispatch);
+    responseCounters(response);
+  }
+  else if (strncmp(request, CMD_HOSTS, strlen(CMD_HOSTS)) == 0) {
+    profileSetCommand(profile, RequestHosts);
+    profileMark(profile, PhaseDispatch);
+    int length = aggregatorFormatHosts(response->text, response->textSize);
+    profileMark(profile, PhaseTask);
+    responseAddFormatted(response, length);
+  }
+  else if (strncmp(request, CMD_CLUSTER, strlen(CMD_CLUSTER)) == 0) {
+    profileSetCommand(profile, RequestCluster);
+    profileMark(profile, PhaseDispatch);
+    int length = aggregatorFormatCluster(response->text, response->textSize);
+    profileMark(profile, PhaseTask);
+    responseAddFormatted(response, length);
+  }
+  else if (strncmp(request, CMD_TOP, strlen(CMD_TOP)) == 0) {
+    profileSetCommand(profile, RequestTop);
+    if (nonBlocking) {
+      profileMark(profile, PhaseDispatch);
+      responseAdd(response, &fragmentNeedsWorker);
+    }
+    else {
+      processTop(request, response, profile);
+    }
+  }
+  else if (strncmp(request, CMD_ALERT, strlen(CMD_ALERT)) == 0 ||
+           strncmp(request, CMD_UNALERT, strlen(CMD_UNALERT)) == 0) 
+  {
+    profileSetCommand(profile, RequestInvalid);
+    responseAdd(response, &fragmentNeedsSession);
+  }
+  else if (strncmp(request, CMD_NODE_CPU, strlen(CMD_NODE_CPU)) == 0) {
+    profileSetCommand(profile, RequestNodeCpu);
+    profileMark(profile, PhaseDispatch);
+    int length = numaFormatCpu(response->text, response->textSize);
+    profileMark(profile, PhaseTask);
+    responseAddFormatted(response, length);
+  }
+  else if (strncmp(request, CMD_NODE_MEM, strlen(CMD_NODE_MEM)) == 0) {
+    profileSetCommand(profile, RequestNodeMem);
+    profileMark(profile, PhaseDispatch);
+    int length = numaFormatMemory(response->text, response->textSize);
+    profileMark(profile, PhaseTask);
+    responseAddFormatted(response, length);
+  }
+  else if (strncmp(request, CMD_PROFILE, strlen(CMD_PROFILE)) == 0) {
+    profileSetCommand(profile, RequestProfile);
+    profileMark(profile, PhaseDispatch);
+    int length = profileFormat(response->text, response->textSize);
+    profileMark(profile, PhaseTask);
+    responseAddFormatted(response, length);
+  }
+  else {
+    profileSetCommand(profile, RequestInvalid);
+    responseAdd(response, &fragmentInvalid);
+  }
+
+  if (response->overflow) {
+    replaceTooLong(response);
+  }
+}
+
+/**
+ * @brief Serves a request received on the given connection.
+ *
+ * Performs a desired operation. Then sends back a response and terminates 
+ * the connection. Runs in a worker process, the event loop is reused only to
+ * enforce the send deadline.
+ *
+ * @param conn The connection holding the complete request.
+ */
+void processRequest(struct connection *conn) 
+{
+  static char responseBuffer[RESPONSE_BUFFER_SIZE];
+
+  shutdown(conn->socket, SHUT_RD);
+  profileStart(&conn->profile);
+  responseInit(&conn->response, responseBuffer, sizeof(responseBuffer));
+
+  // perform the requested task
+  char *newline = memchr(conn->buffer, '\n', conn->size);
+  printf("%d: Recognized request \"%.*s\"\n", getpid(), 
+    newline ? (int) (newline - conn->buffer) : conn->size, conn->buffer);
+  processCommand(conn->buffer, &conn->response, 0, &conn->profile);
+  profileMark(&conn->profile, PhaseFormat);
+
+  // send the response with a deadline, the connection is closed afterwards
+  loopInit();
+  loopAddFd(conn->socket, POLLOUT, onWritable, conn);
+  if (armDeadline(conn, WRITE_TIMEOUT_MS, onWriteTimeout)) {
+    loopRun(&signalCaught);
   }
-  shutdown(socket, SHUT_WR);
-  close(socket);
   
   printf("%d: Request handled, exiting.\n", getpid());
 }
 
 /**
- * @brief Starts a TCP server listening on the given port
+ * @brief Answers a complete HTTP request from the listening process itself.
+ *
+ * The metrics are exposed from the sampled values, which takes no time, so no
+ * worker is forked. The response is formatted into the output buffer of the
+ * connection and sent as the socket accepts it, the connection is closed
+ * afterwards.
+ *
+ * @param conn The connection holding the complete request.
+ */
+void processHttp(struct connection *conn)
+{
+  metricsIncrement(MetricRequests);
+  shutdown(conn->socket, SHUT_RD);
+  profileStart(&conn->profile);
+  profileSetCommand(&conn->profile, RequestHttp);
+  responseInit(&conn->response, conn->output, sizeof(conn->output));
+  responseAddText(&conn->response, conn->output, 
+    httpBuildResponse(conn->buffer, conn->size, conn->output, sizeof(conn->output)));
+  profileMark(&conn->profile, PhaseFormat);
+
+  // the receive deadline turns into the send deadline
+  loopCancelTimer(conn->timer);
+  loopRemoveFd(conn->socket);
+  loopAddFd(conn->socket, POLLOUT, onWritable, conn);
+  if (armDeadline(conn, WRITE_TIMEOUT_MS, onWriteTimeout)) {
+    onWritable(conn->socket, POLLOUT, conn);
+  }
+}
+
+/**
+ * @brief Hands a completely received request over to a new worker process.
+ *
+ * Requests are executed in a separate process because some tasks take a long
+ * time. The listening process only keeps accepting and reading. At most
+ * MAX_WORKERS workers run at the same time, further requests are refused.
+ *
+ * @param conn The connection holding the complete request.
+ */
+void startWorker(struct connection *conn)
+{
+  if (workerCount >= MAX_WORKERS) {
+    printf("%d: Too many workers, refusing the request\n", getpid());
+    metricsIncrement(MetricConnectionsRejected);
+    send(conn->socket, RESPONSE_BUSY, strlen(RESPONSE_BUSY), MSG_DONTWAIT | MSG_NOSIGNAL);
+    closeConnection(conn);
+    return;
+  }
+  metricsIncrement(MetricRequests);
+
+  // avoid the child flushing our buffered log lines once more
+  fflush(stdout);
+
+  // a worker finishing before it is counted must not be reaped in between
+  sigset_t childSignal, previousMask;
+  sigemptyset(&childSignal);
+  sigaddset(&childSignal, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &childSignal, &previousMask);
+
+  switch(fork()) {
+    case 0:
+      sigprocmask(SIG_SETMASK, &previousMask, NULL);
+      printf("%d: Processing a new connection\n", getpid());
+      profileOpen();
+      for (int i = 0; i < listenerCount; i++) {
+        close(listeners[i].socket);
+      }
+      for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        if (connections[i].socket >= 0 && &connections[i] != conn) {
+          close(connections[i].socket);
+        }
+      }
+      processRequest(conn);
+      exit(ErrOK);
+
+    case -1:
+      die("fork()", ErrProcess);
+
+    default:
+      workerCount++;
+      sigprocmask(SIG_SETMASK, &previousMask, NULL);
+      closeConnection(conn);
+      break;
+  }
+}
+
+/**
+ * @brief Drops a client which did not send a complete request in time.
+ *
+ * @param data The connection.
+ */
+void onReadTimeout(void *data)
+{
+  printf("%d: Request not received in time, closing connection\n", getpid());
+  metricsIncrement(MetricReadTimeouts);
+  closeConnection((struct connection *) data);
+}
+
+/**
+ * @brief Skips HTTP request headers, keeping only the request line in the buffer.
+ *
+ * @param conn The HTTP connection.
+ * @param data The received data.
+ * @param size The number of received bytes.
+ * @returns Nonzero once the empty line terminating the headers was received.
+ */
+int consumeHttpHeaders(struct connection *conn, const char *data, int size)
+{
+  // the request line (or its prefix) is all the responder needs
+  int copy = BUFFER_SIZE - conn->size < size ? BUFFER_SIZE - conn->size : size;
+  memcpy(conn->buffer + conn->size, data, copy);
+  conn->size += copy;
+
+  // look for "\r\n\r\n", tolerate bare "\n\n" as well
+  for (int i = 0; i < size; i++) {
+    if (data[i] == '\n') {
+      conn->headerEnd = conn->headerEnd >= 2 ? 4 : 2;
+    }
+    else if (data[i] == '\r' && (conn->headerEnd == 0 || conn->headerEnd == 2)) {
+      conn->headerEnd++;
+    }
+    else {
+      conn->headerEnd = 0;
+    }
+    if (conn->headerEnd == 4) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Closes a session which has been idle for too long.
+ *
+ * Sessions waiting for alerts are kept open. A partial request line is timed
+ * out by onReadTimeout() instead, rules or not.
+ *
+ * @param data The connection.
+ */
+void onSessionIdle(void *data)
+{
+  struct connection *conn = (struct connection *) data;
+  if (alertsCount(conn) > 0) {
+    armDeadline(conn, SESSION_IDLE_TIMEOUT_MS, onSessionIdle);
+    return;
+  }
+  printf("%d: Session idle, closing connection\n", getpid());
+  metricsIncrement(MetricReadTimeouts);
+  closeConnection(conn);
+}
+
+/**
+ * @brief Sends as much of the pending session output as the socket accepts.
+ * The socket is watched for writability only while some output remains.
+ *
+ * @param conn The session.
+ */
+void flushSession(struct connection *conn)
+{
+  if (conn->outputSize > 0) {
+    int size = send(conn->socket, conn->output, conn->outputSize, MSG_NOSIGNAL);
+    if (size < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      printf("%d: send() failed, closing session. %s\n", getpid(), strerror(errno));
+      closeConnection(conn);
+      return;
+    }
+    if (size > 0) {
+      memmove(conn->output, conn->output + size, conn->outputSize - size);
+      conn->outputSize -= size;
+    }
+  }
+  loopModifyFd(conn->socket, conn->outputSize > 0 ? POLLIN | POLLOUT : POLLIN);
+}
+
+/**
+ * @brief Serves all complete request lines of a session.
+ *
+ * Requests are served right away from the sampled values. Each response is
+ * followed by an empty line, so that multi-line responses can be told apart.
+ * A client which does not read its responses is disconnected.
+ *
+ * Only a served line restarts the idle timeout. A partial line must be
+ * completed within READ_TIMEOUT_MS, counted from the data which started it, so
+ * a client trickling bytes cannot keep the session open.
+ *
+ * @param conn The session.
+ */
+void processSession(struct connection *conn)
+{
+  static char text[RESPONSE_BUFFER_SIZE];
+  struct response response;
+  char request[BUFFER_SIZE + 1];
+  char *newline;
+  int served = 0;
+
+  while ((newline = memchr(conn->buffer, '\n', conn->size)) != NULL) {
+    int length = newline - conn->buffer + 1;
+    memcpy(request, conn->buffer, length);
+    request[length] = '\0';
+    memmove(conn->buffer, conn->buffer + length, conn->size - length);
+    conn->size -= length;
+
+    if (SESSION_OUTPUT_SIZE - conn->outputSize < RESPONSE_BUFFER_SIZE + 1) {
+      flushSession(conn);
+      if (conn->socket < 0) {
+        return;
+      }
+    }
+    if (SESSION_OUTPUT_SIZE - conn->outputSize < RESPONSE_BUFFER_SIZE + 1) {
+      printf("%d: Session output full, closing connection\n", getpid());
+      metricsIncrement(MetricWriteTimeouts);
+      closeConnection(conn);
+      return;
+    }
+    metricsIncrement(MetricRequests);
+    traceRequest(TraceSession, (struct sockaddr *) &conn->peer, request, length);
+    char *output = conn->output + conn->outputSize;
+    if (strncmp(request, CMD_ALERT, strlen(CMD_ALERT)) == 0) {
+      conn->outputSize += alertsAdd(conn, request, output, RESPONSE_BUFFER_SIZE);
+    }
+    else if (strncmp(request, CMD_UNALERT, strlen(CMD_UNALERT)) == 0) {
+      conn->outputSize += alertsRemove(conn, request, output, RESPONSE_BUFFER_SIZE);
+    }
+    else {
+      responseInit(&response, text, sizeof(text));
+      processCommand(request, &response, 1, NULL);
+      if (response.length > RESPONSE_BUFFER_SIZE) {
+        replaceTooLong(&response);
+      }
+      conn->outputSize += responseCopy(&response, output, RESPONSE_BUFFER_SIZE);
+    }
+    conn->output[conn->outputSize++] = '\n';
+    served++;
+  }
+
+  // a line longer than the buffer is not a valid request
+  if (conn->size == BUFFER_SIZE) {
+    printf("%d: Request too long, closing session\n", getpid());
+    closeConnection(conn);
+    return;
+  }
+
+  if (conn->size > 0 && (served > 0 || !conn->lineDeadline)) {
+    loopCancelTimer(conn->timer);
+    conn->lineDeadline = 1;
+    if (!armDeadline(conn, READ_TIMEOUT_MS, onReadTimeout)) {
+      return;
+    }
+  }
+  else if (conn->size == 0 && served > 0) {
+    loopCancelTimer(conn->timer);
+    conn->lineDeadline = 0;
+    if (!armDeadline(conn, SESSION_IDLE_TIMEOUT_MS, onSessionIdle)) {
+      return;
+    }
+  }
+  flushSession(conn);
+}
+
+/**
+ * @brief Pushes an alert event to the session which registered the rule.
+ *
+ * Like a response, the event is followed by an empty line. A client which does
+ * not read its events is disconnected.
+ *
+ * @param owner The session.
+ * @param event The event line.
+ */
+void onAlert(void *owner, const char *event)
+{
+  struct connection *conn = (struct connection *) owner;
+  int length = strlen(event);
+
+  if (SESSION_OUTPUT_SIZE - conn->outputSize < length + 1) {
+    flushSession(conn);
+    if (conn->socket < 0) {
+      return;
+    }
+  }
+  if (SESSION_OUTPUT_SIZE - conn->outputSize < length + 1) {
+    printf("%d: Session output full, closing connection\n", getpid());
+    metricsIncrement(MetricWriteTimeouts);
+    closeConnection(conn);
+    return;
+  }
+  memcpy(conn->output + conn->outputSize, event, length);
+  conn->outputSize += length;
+  conn->output[conn->outputSize++] = '\n';
+  flushSession(conn);
+}
+
+/**
+ * @brief Turns the connection into a session once it asked for it.
+ *
+ * At most MAX_SESSIONS sessions are open, further ones are refused.
+ *
+ * @param conn A line protocol connection.
+ * @returns 1 if the connection is a session, 0 if not, -1 if the session has
+ *          been refused or closed because its idle timeout could not be armed.
+ */
+int checkSession(struct connection *conn)
+{
+  int length = strlen(CMD_SESSION);
+  if (!conn->session && conn->size >= length && 
+      strncmp(conn->buffer, CMD_SESSION, length) == 0) 
+  {
+    if (sessionCount >= MAX_SESSIONS) {
+      printf("%d: Too many sessions, rejecting\n", getpid());
+      metricsIncrement(MetricConnectionsRejected);
+      send(conn->socket, RESPONSE_TOO_MANY_SESSIONS, strlen(RESPONSE_TOO_MANY_SESSIONS), 
+        MSG_DONTWAIT | MSG_NOSIGNAL);
+      closeConnection(conn);
+      return -1;
+    }
+    printf("%d: Starting a session\n", getpid());
+    conn->session = 1;
+    conn->lineDeadline = 0;
+    conn->outputSize = 0;
+    sessionCount++;
+    memmove(conn->buffer, conn->buffer + length, conn->size - length);
+    conn->size -= length;
+
+    // the receive deadline turns into the idle timeout
+    loopCancelTimer(conn->timer);
+    if (!armDeadline(conn, SESSION_IDLE_TIMEOUT_MS, onSessionIdle)) {
+      return -1;
+    }
+  }
+  return conn->session;
+}
+
+/**
+ * @brief Collects the request data.
+ * A line protocol request is complete after a newline or when the buffer
+ * is full, an HTTP request after the headers. Either is complete when the
+ * client shuts down its side of the connection. Sessions are served as their
+ * requests arrive.
+ *
+ * @param socket The connection socket.
+ * @param revents Ignored, errors are reported by recv().
+ * @param data The connection.
+ */
+void onReadable(int socket, short revents, void *data)
+{
+  struct connection *conn = (struct connection *) data;
+  char chunk[HTTP_CHUNK_SIZE];
+
+  if (conn->session && (revents & POLLOUT)) {
+    flushSession(conn);
+    if (conn->socket < 0 || !(revents & (POLLIN | POLLHUP | POLLERR))) {
+      return;
+    }
+  }
+
+  int size;
+  profileStart(&conn->profile);
+  if (conn->protocol == ProtocolHttp) {
+    size = recv(socket, chunk, sizeof(chunk), 0);
+  }
+  else {
+    size = recv(socket, conn->buffer + conn->size, BUFFER_SIZE - conn->size, 0);
+  }
+  profileMark(&conn->profile, PhaseRecv);
+  if (size < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+      return;
+    }
+    printf("%d: recv() failed, closing connection. %s\n", getpid(), strerror(errno));
+    closeConnection(conn);
+    return;
+  }
+
+  if (conn->session && size == 0) {
+    closeConnection(conn);
+    return;
+  }
+
+  int complete = (size == 0);
+  if (conn->protocol == ProtocolHttp) {
+    complete |= consumeHttpHeaders(conn, chunk, size);
+  }
+  else {
+    conn->size += size;
+    if (conn->protocol == ProtocolLine) {
+      int session = checkSession(conn);
+      if (session > 0) {
+        processSession(conn);
+      }
+      if (session != 0) {
+        return;
+      }
+    }
+    complete |= conn->size == BUFFER_SIZE || memchr(conn->buffer, '\n', conn->size) != NULL;
+  }
+  if (complete) {
+    traceRequest(conn->protocol == ProtocolHttp ? TraceHttp : 
+      conn->peer.ss_family == AF_UNIX ? TraceUnix : TraceTcp, 
+      (struct sockaddr *) &conn->peer, conn->buffer, conn->size);
+    if (conn->protocol == ProtocolHttp) {
+      processHttp(conn);
+    }
+    else {
+      startWorker(conn);
+    }
+  }
+}
+
+/**
+ * @brief Accepts pending connections and arms their receive deadline.
+ *
+ * Connections over the MAX_CONNECTIONS limit are closed right away, so idle
+ * clients cannot exhaust the processes or memory of the host.
+ *
+ * @param socket The listening socket.
+ * @param revents Ignored.
+ * @param data The listener.
+ */
+void onAccept(int socket, short revents, void *data)
+{
+  struct listener *listener = (struct listener *) data;
+
+  while (1) {
+    struct profileSample profile;
+    struct sockaddr_storage peer;
+    socklen_t peerSize = sizeof(peer);
+    profileReset(&profile);
+    int peerSocket = accept4(socket, (struct sockaddr *) &peer, &peerSize, SOCK_NONBLOCK);
+    if (peerSocket < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ECONNABORTED) {
+        return;
+      }
+      die("accept()", ErrNetwork);
+    }
+    metricsIncrement(MetricConnectionsAccepted);
+
+    struct connection *conn = NULL;
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+      if (connections[i].socket < 0) {
+        conn = &connections[i];
+        break;
+      }
+    }
+    if (!conn || loopAddFd(peerSocket, POLLIN, onReadable, conn) < 0) {
+      printf("%d: Too many connections, rejecting\n", getpid());
+      metricsIncrement(MetricConnectionsRejected);
+      close(peerSocket);
+      continue;
+    }
+
+    conn->socket = peerSocket;
+    conn->protocol = listener->protocol;
+    conn->profile = profile;
+    conn->peer = peer;
+    profileMark(&conn->profile, PhaseAccept);
+    conn->size = 0;
+    conn->headerEnd = 0;
+    conn->session = 0;
+    memset(conn->buffer, 0, sizeof(conn->buffer));
+    if (!armDeadline(conn, READ_TIMEOUT_MS, onReadTimeout)) {
+      metricsIncrement(MetricConnectionsRejected);
+    }
+  }
+}
+
+/**
+ * @brief Answers a batch of datagram requests.
+ *
+ * Each request datagram gets a single response datagram. The requests are
+ * served inline from the background CPU sample, so they never block the loop.
+ * Responses which cannot be sent right away are dropped.
+ *
+ * @param socket The UDP socket.
+ * @param revents Ignored.
+ * @param data Ignored.
+ */
+void onDatagrams(int socket, short revents, void *data)
+{
+  static char requests[UDP_BATCH_SIZE][BUFFER_SIZE];
+  static char texts[UDP_BATCH_SIZE][RESPONSE_BUFFER_SIZE];
+  static struct response responses[UDP_BATCH_SIZE];
+  static struct sockaddr_in peers[UDP_BATCH_SIZE];
+  static struct iovec vectors[UDP_BATCH_SIZE];
+  static struct mmsghdr messages[UDP_BATCH_SIZE];
+
+  for (int i = 0; i < UDP_BATCH_SIZE; i++) {
+    vectors[i].iov_base = requests[i];
+    vectors[i].iov_len = BUFFER_SIZE;
+    memset(&messages[i], 0, sizeof(messages[i]));
+    messages[i].msg_hdr.msg_name = &peers[i];
+    messages[i].msg_hdr.msg_namelen = sizeof(peers[i]);
+    messages[i].msg_hdr.msg_iov = &vectors[i];
+    messages[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  int count = recvmmsg(socket, messages, UDP_BATCH_SIZE, MSG_DONTWAIT, NULL);
+  if (count < 0) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      printf("%d: recvmmsg() failed. %s\n", getpid(), strerror(errno));
+    }
+    return;
+  }
+
+  // the responses are sent back to the peers recorded by recvmmsg(), each
+  // datagram gathered from the fragments of its response
+  for (int i = 0; i < count; i++) {
+    int size = messages[i].msg_len;
+    memset(requests[i] + size, 0, BUFFER_SIZE - size);
+    traceRequest(TraceUdp, (struct sockaddr *) &peers[i], requests[i], size);
+    responseInit(&responses[i], texts[i], RESPONSE_BUFFER_SIZE);
+    processCommand(requests[i], &responses[i], 1, NULL);
+    messages[i].msg_hdr.msg_iov = responses[i].fragments;
+    messages[i].msg_hdr.msg_iovlen = responses[i].count;
+    metricsIncrement(MetricDatagrams);
+  }
+
+  int sent = sendmmsg(socket, messages, count, MSG_DONTWAIT);
+  for (int i = sent < 0 ? 0 : sent; i < count; i++) {
+    metricsIncrement(MetricDatagramsDropped);
+  }
+}
+
+/**
+ * @brief Starts listening on the given port
  * 
- * Opens port on the localhost. Any incoming connections for a new process which handles
- * it. This function can return only if a signal is received to stop the server.
+ * Opens port on the localhost and registers it with the event loop. Every
+ * connection accepted on it (or every datagram for UDP) is expected to speak
+ * the given protocol.
  *
  * @param port The listenin port of the server.
+ * @param protocol The protocol served on the port.
  */
-void listenOnPort(int port)
+void listenOnPort(int port, enum protocol protocol)
 {
-  struct sockaddr_in serverAddress, peerAddress;
+  static const char *protocolNames[] = { "line", "http", "udp" };
+  struct sockaddr_in serverAddress;
   
-  int serverSocket = socket(AF_INET, SOCK_STREAM, 0);
+  if (listenerCount == MAX_LISTENERS) {
+    die("listenOnPort()", ErrNetwork);
+  }
+  int type = protocol == ProtocolUdp ? SOCK_DGRAM : SOCK_STREAM;
+  int serverSocket = socket(AF_INET, type | SOCK_NONBLOCK, 0);
   if (serverSocket < 0) {
     die("socket()", ErrNetwork);
   }
@@ -184,40 +1098,102 @@ void listenOnPort(int port)
   if (bind(serverSocket, (struct sockaddr *) &serverAddress, sizeof(serverAddress)) != 0) {
     die("bind()", ErrNetwork);
   }
+  if (type == SOCK_STREAM && listen(serverSocket, BACKLOG_SIZE) < 0) {
+    die("listen()", ErrNetwork);
+  }
+  printf("%d: Listening on port %d (%s)\n", getpid(), port, protocolNames[protocol]);
+
+  struct listener *listener = &listeners[listenerCount++];
+  listener->socket = serverSocket;
+  listener->protocol = protocol;
+  loopAddFd(serverSocket, POLLIN, type == SOCK_DGRAM ? onDatagrams : onAccept, listener);
+}
+
+/**
+ * @brief Starts listening on the given Unix domain socket
+ *
+ * The socket speaks the line protocol, exactly like the TCP port. An existing
+ * filesystem socket is replaced.
+ *
+ * @param path An absolute filesystem path, or a name in the abstract namespace
+ *             prefixed by '@'.
+ */
+void listenOnUnixSocket(const char *path)
+{
+  struct sockaddr_un serverAddress;
+
+  socklen_t length = fillUnixAddress(path, &serverAddress);
+  if (length == 0 || listenerCount == MAX_LISTENERS) {
+    die("listenOnUnixSocket()", ErrArgs);
+  }
+  int serverSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (serverSocket < 0) {
+    die("socket()", ErrNetwork);
+  }
+  if (path[0] != '@') {
+    unlink(path);
+  }
+  if (bind(serverSocket, (struct sockaddr *) &serverAddress, length) != 0) {
+    die("bind()", ErrNetwork);
+  }
   if (listen(serverSocket, BACKLOG_SIZE) < 0) {
     die("listen()", ErrNetwork);
   }
-  printf("%d: Listening on port %d\n", getpid(), PORT);
+  printf("%d: Listening on %s (line)\n", getpid(), path);
 
-  // accept connections until a signal is received  
-  while (!signalCaught) {
-    unsigned int size;    
-    size = sizeof(peerAddress);
-    int peerSocket = accept(serverSocket, (struct sockaddr *) &peerAddress, &size);
-    if (signalCaught) {
-      printf("%d: Caught signal, exiting.\n", getpid());
-      break;
-    }
-    if (peerSocket < 0) {
-      die("accept()", ErrNetwork);
-    }
-    
-    // fork a new process for each request
-    switch(fork()) {
-      case 0:
-        printf("%d: Processing a new connection\n", getpid());
-        close(serverSocket);
-        processRequest(peerSocket);
-        exit(ErrOK);
+  struct listener *listener = &listeners[listenerCount++];
+  listener->socket = serverSocket;
+  listener->protocol = ProtocolLine;
+  loopAddFd(serverSocket, POLLIN, onAccept, listener);
+}
 
-      case -1:
-        close(serverSocket);
-        die("fork()", ErrProcess);
+/**
+ * @brief Takes a CPU and memory usage sample and schedules the next one.
+ * The sample is published into the shared memory page, if there is one.
+ *
+ * @param data Ignored.
+ */
+void onCpuSampleTimer(void *data)
+{
+  taskSampleCpu();
+  taskSampleMemory();
+  long memoryKb = taskGetSampledMemoryKb();
+  alertsEvaluate(taskGetSampledCpuUsage() * 100, memoryKb, nowMs());
+  aggregatorTick();
+  traceFlush();
+  if (metricsPage) {
+    shmPagePublish(metricsPage, taskGetSampledCpuUsage(), memoryKb);
+  }
+  // without the sample timer the daemon would silently serve stale values
+  if (loopAddTimer(CPU_SAMPLE_INTERVAL_MS, onCpuSampleTimer, NULL) < 0) {
+    die("loopAddTimer()", ErrProcess);
+  }
+}
 
-      default:
-        break;
-    }
+/**
+ * @brief Serves connections on all the listening sockets.
+ *
+ * Connections are read by an event loop and every complete request is handed
+ * over to a new process. This function can return only if a signal is received
+ * to stop the server.
+ */
+void serve()
+{
+  for (int i = 0; i < MAX_CONNECTIONS; i++) {
+    connections[i].socket = -1;
+    connections[i].timer = -1;
   }
+  alertsInit(onAlert);
+  aggregatorStart();
+  numaStart(CPU_SAMPLE_INTERVAL_MS);
+  // after the samplers, their threads are not counted
+  profileOpen();
+  onCpuSampleTimer(NULL);
+
+  // serve connections until a signal is received  
+  loopRun(&signalCaught);
+  traceFlush();
+  printf("%d: Caught signal, exiting.\n", getpid());
 }
 
 /**
@@ -238,25 +1214,184 @@ void setupSignals()
     die("sigaction()", ErrSignal);
   }
   
-  // Make the daemon ignore exit status of its children
+  // Reap the children to know how many workers are running
   bzero(&action, sizeof(struct sigaction));
-  action.sa_handler = SIG_IGN;
+  action.sa_handler = sigChldHandler;
+  action.sa_flags = SA_RESTART;
   sigemptyset(&action.sa_mask);
   if (sigaction(SIGCHLD, &action, NULL) < 0) {
     die("sigaction()", ErrSignal);
   }
 }
 
+/**
+ * @brief Checks the command line arguments.
+ *
+ * Prints usage and exits if the arguments are invalid.
+ *
+ * @param argc Argument count
+ * @param argv Array of argument strings
+ * @param port The line protocol port is passed back through here, PORT by default
+ * @param httpPort The HTTP port is passed back through here, 0 if not requested
+ * @param udp Set to nonzero if the UDP listener was requested
+ * @param unixPath The Unix domain socket path is passed back through here, NULL if
+ *                 not requested
+ * @param shmName The shared memory page name is passed back through here, NULL if
+ *                not requested
+ * @param downstreams The list of downstream daemons to aggregate is passed back 
+ *                    through here, NULL if not requested
+ * @param profile Set to nonzero if the request path should be profiled
+ * @param procRoot The directory to read the metrics from is passed back through
+ *                 here, NULL if not requested
+ * @param tracePath The file to record the request arrivals into is passed back
+ *                  through here, NULL if not requested
+ */
+void processArguments(int argc, char *argv[], int *port, int *httpPort, int *udp, 
+  char **unixPath, char **shmName, char **downstreams, int *profile, char **procRoot,
+  char **tracePath)
+{
+  *port = PORT;
+  *httpPort = 0;
+  *udp = 0;
+  *unixPath = NULL;
+  *shmName = NULL;
+  *downstreams = NULL;
+  *profile = 0;
+  *procRoot = NULL;
+  *tracePath = NULL;
+  // a value which fails the validation stops the parsing, like an unknown option
+  int i;
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], OPTION_PROFILE) == 0) {
+      *profile = 1;
+      continue;
+    }
+    if (strcmp(argv[i], OPTION_AGGREGATE) == 0 && i + 1 < argc) {
+      *downstreams = argv[++i];
+      continue;
+    }
+    if (strcmp(argv[i], OPTION_SHM) == 0 && i + 1 < argc) {
+      *shmName = argv[++i];
+      if ((*shmName)[0] != '/' || (*shmName)[1] == '\0' || strchr(*shmName + 1, '/')) {
+        break;
+      }
+      continue;
+    }
+    if (strcmp(argv[i], OPTION_UDP) == 0) {
+      *udp = 1;
+      continue;
+    }
+    // the daemon leaves its working directory, so relative paths are refused
+    if (strcmp(argv[i], OPTION_PROC_ROOT) == 0 && i + 1 < argc) {
+      *procRoot = argv[++i];
+      if ((*procRoot)[0] != '/') {
+        break;
+      }
+      continue;
+    }
+    if (strcmp(argv[i], OPTION_TRACE) == 0 && i + 1 < argc) {
+      *tracePath = argv[++i];
+      if ((*tracePath)[0] != '/') {
+        break;
+      }
+      continue;
+    }
+    if (strcmp(argv[i], OPTION_UNIX) == 0 && i + 1 < argc) {
+      *unixPath = argv[++i];
+      struct sockaddr_un address;
+      if (((*unixPath)[0] != '/' && (*unixPath)[0] != '@') || 
+          fillUnixAddress(*unixPath, &address) == 0) 
+      {
+        break;
+      }
+      continue;
+    }
+    if (strcmp(argv[i], OPTION_PORT) == 0 && i + 1 < argc) {
+      *port = atoi(argv[++i]);
+      if (*port <= 0 || *port >= 65536) {
+        break;
+      }
+      continue;
+    }
+    if (strcmp(argv[i], OPTION_HTTP_PORT) == 0 && i + 1 < argc) {
+      *httpPort = atoi(argv[++i]);
+      if (*httpPort <= 0 || *httpPort >= 65536) {
+        break;
+      }
+      continue;
+    }
+    break;
+  }
+  if (i < argc) {
+    printf(USAGE);
+    exit(ErrArgs);
+  }
+}
+
 /**
  * @brief Starts the daemon.
+ *
+ * @param argc Argument count
+ * @param argv Optionally "-p <port>" to listen on another port than PORT, "-u" to
+ *             serve requests over UDP as well, "-H <port>" to serve Prometheus
+ *             metrics over HTTP, "-U <path>" to serve requests over a Unix domain
+ *             socket as well, "-S <name>" to publish the samples into a shared
+ *             memory page, "-A <hosts>" to aggregate the metrics of the listed
+ *             downstream daemons, "-P" to profile the request path, "-R <dir>"
+ *             to read the metrics from another directory than /proc and
+ *             "-T <file>" to record the request arrivals into a trace.
  */
-int main()
+int main(int argc, char *argv[])
 {
+  int port, httpPort, udp, profile;
+  char *unixPath, *shmName, *downstreams, *procRoot, *tracePath;
+
+  processArguments(argc, argv, &port, &httpPort, &udp, &unixPath, &shmName, &downstreams,
+    &profile, &procRoot, &tracePath);
+  if (procRoot) {
+    taskSetProcRoot(procRoot);
+  }
+  if (downstreams) {
+    aggregatorInit(downstreams);
+  }
   printf("%d: Server starting\n", getpid());
   
   runAsDaemon();
   setupSignals();
-  listenOnPort(PORT);
+  metricsInit();
+  topInit();
+  numaInit();
+  if (profile) {
+    profileInit(requestNames, RequestKindCount);
+  }
+  if (tracePath) {
+    traceOpen(tracePath);
+    printf("%d: Recording requests to %s\n", getpid(), tracePath);
+  }
+  loopInit();
+  listenOnPort(port, ProtocolLine);
+  if (udp) {
+    listenOnPort(port, ProtocolUdp);
+  }
+  if (unixPath) {
+    listenOnUnixSocket(unixPath);
+  }
+  if (httpPort) {
+    listenOnPort(httpPort, ProtocolHttp);
+  }
+  if (shmName) {
+    metricsPage = shmPageCreate(shmName);
+    printf("%d: Publishing samples to %s\n", getpid(), shmName);
+  }
+  serve();
+
+  if (shmName) {
+    shm_unlink(shmName);
+  }
+
+  if (unixPath && unixPath[0] != '@') {
+    unlink(unixPath);
+  }
 
   return ErrOK;
 }
@@ -0,0 +1,56 @@
+/**
+ * @file shmpage.c
+ * @brief Writer side of the shared memory metrics page.
+ *
+ * There must be a single writer, the daemon's listening process.
+ *
+ * @author Karel Dolezal, akwky@centrum.cz
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+
+#include "common.h"
+#include "shmpage.h"
+
+struct shmPage *shmPageCreate(const char *name)
+{
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    die("shm_open()", ErrFile);
+  }
+  if (ftruncate(fd, sizeof(struct shmPage)) != 0) {
+    close(fd);
+    die("ftruncate()", ErrFile);
+  }
+  struct shmPage *page = mmap(NULL, sizeof(struct shmPage), PROT_READ | PROT_WRITE,
+    MAP_SHARED, fd, 0);
+  close(fd);
+  if (page == MAP_FAILED) {
+    die("mmap()", ErrFile);
+  }
+
+  // the magic goes last, readers refuse the page until it is set
+  memset(page, 0, sizeof(*page));
+  page->version = SHM_PAGE_VERSION;
+  page->size = sizeof(*page);
+  __atomic_store_n(&page->magic, SHM_PAGE_MAGIC, __ATOMIC_RELEASE);
+  return page;
+}
+
+void shmPagePublish(struct shmPage *page, float cpuUsage, long memoryUsedKb)
+{
+  uint32_t sequence = page->sequence;
+
+  // odd sequence: readers retry until the update is complete
+  __atomic_store_n(&page->sequence, sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  __atomic_store_n(&page->updatedMs, (uint64_t) nowMs(), __ATOMIC_RELAXED);
+  __atomic_store_n(&page->updates, page->updates + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&page->cpuUsagePpm, (uint32_t) (cpuUsage * 1000000 + 0.5), __ATOMIC_RELAXED);
+  __atomic_store_n(&page->memoryUsedKb, (uint64_t) memoryUsedKb, __ATOMIC_RELAXED);
+
+  __atomic_store_n(&page->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,160 @@
+/**
+ * @file shmpage.h
+ * @brief Shared memory page with the latest metrics sampled by the daemon.
+ *
+ * The daemon (see "-S" option of the server) publishes its samples into a POSIX
+ * shared memory object. Local processes map it read-only and read consistent
+ * values without any system call, using the inline reader functions below.
+ * The reader part is header-only, copy this file to use it elsewhere.
+ *
+ * The page is protected by a sequence lock: the writer makes the sequence odd
+ * while updating, readers retry until they see the same even sequence before
+ * and after copying the values.
+ *
+ * Layout rules: the first four fields never change. Fields are only ever appended,
+ * the writer's "size" tells which of them are present. "version" changes only
+ * when the meaning of existing fields changes, readers must reject other versions.
+ *
+ * @author Karel Dolezal, akwky@centrum.cz
+ */
+
+#ifndef _SHMPAGE_H_
+#define _SHMPAGE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Identifies the page, "DMTR" in memory on little endian hosts
+#define SHM_PAGE_MAGIC    0x52544d44
+// Layout version described by struct shmPage
+#define SHM_PAGE_VERSION  1
+// Bound for the reader's retries, reached only if the writer died while updating
+#define SHM_PAGE_MAX_RETRIES 100000
+
+/**
+ * The shared memory layout. All fields are naturally aligned, in host byte order.
+ */
+struct shmPage
+{
+  // header, identical in all versions
+  uint32_t magic;           // SHM_PAGE_MAGIC
+  uint32_t version;         // SHM_PAGE_VERSION
+  uint32_t size;            // sizeof(struct shmPage) of the writer
+  uint32_t sequence;        // sequence lock, odd while being updated
+
+  // version 1
+  uint64_t updatedMs;       // CLOCK_MONOTONIC milliseconds of the last update
+  uint64_t updates;         // number of updates since the daemon started
+  uint32_t cpuUsagePpm;     // total CPU usage over the last sample, parts per million
+  uint32_t reserved;
+  uint64_t memoryUsedKb;    // used memory as reported by the "mem" command
+};
+
+/**
+ * A consistent copy of the values in the page.
+ */
+struct shmSnapshot
+{
+  uint64_t updatedMs;
+  uint64_t updates;
+  uint32_t cpuUsagePpm;
+  uint64_t memoryUsedKb;
+};
+
+/**
+ * @brief Maps an existing metrics page for reading.
+ *
+ * @param name The shared memory object name, e.g. "/daemon-metrics".
+ * @returns The mapped page, or NULL with errno set on failure.
+ */
+static inline const struct shmPage *shmPageOpen(const char *name)
+{
+  int fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size < (off_t) sizeof(struct shmPage)) {
+    close(fd);
+    errno = EPROTO;
+    return NULL;
+  }
+  void *page = mmap(NULL, sizeof(struct shmPage), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (page == MAP_FAILED) {
+    return NULL;
+  }
+  if (((const struct shmPage *) page)->magic != SHM_PAGE_MAGIC) {
+    munmap(page, sizeof(struct shmPage));
+    errno = EPROTO;
+    return NULL;
+  }
+  return (const struct shmPage *) page;
+}
+
+/**
+ * @brief Unmaps a page returned by shmPageOpen().
+ *
+ * @param page The page.
+ */
+static inline void shmPageClose(const struct shmPage *page)
+{
+  munmap((void *) page, sizeof(struct shmPage));
+}
+
+/**
+ * @brief Reads a consistent snapshot of the page. No system calls are made.
+ *
+ * @param page The page.
+ * @param snapshot The values are copied here.
+ * @returns Zero on success, -1 with errno set to EPROTO for an unknown layout
+ *          version or to EAGAIN if the writer seems stuck in an update.
+ */
+static inline int shmPageRead(const struct shmPage *page, struct shmSnapshot *snapshot)
+{
+  if (page->version != SHM_PAGE_VERSION) {
+    errno = EPROTO;
+    return -1;
+  }
+
+  for (int retry = 0; retry < SHM_PAGE_MAX_RETRIES; retry++) {
+    uint32_t begin = __atomic_load_n(&page->sequence, __ATOMIC_ACQUIRE);
+    if (begin & 1) {
+      continue;
+    }
+    snapshot->updatedMs = __atomic_load_n(&page->updatedMs, __ATOMIC_RELAXED);
+    snapshot->updates = __atomic_load_n(&page->updates, __ATOMIC_RELAXED);
+    snapshot->cpuUsagePpm = __atomic_load_n(&page->cpuUsagePpm, __ATOMIC_RELAXED);
+    snapshot->memoryUsedKb = __atomic_load_n(&page->memoryUsedKb, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&page->sequence, __ATOMIC_RELAXED) == begin) {
+      return 0;
+    }
+  }
+  errno = EAGAIN;
+  return -1;
+}
+
+/**
+ * @brief Creates (or resets) the metrics page. Daemon side, see shmpage.c.
+ *
+ * @param name The shared memory object name.
+ * @returns The mapped page, the function exits on error.
+ */
+struct shmPage *shmPageCreate(const char *name);
+
+/**
+ * @brief Publishes new values into the page. Daemon side, see shmpage.c.
+ *
+ * @param page The page.
+ * @param cpuUsage CPU usage in the range 0 - 1.0.
+ * @param memoryUsedKb Used memory in kB.
+ */
+void shmPagePublish(struct shmPage *page, float cpuUsage, long memoryUsedKb);
+
+#endif
@@ -10,80 +10,165 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 #include "common.h"
 #include "tasks.h"
 
-// Note: The format's string length limitation must take into account
-//       the total size of the buffer defined in LINE_BUFFER_SIZE
-#define MEMINFO_FORMAT   "%79s %ld kB"
-// Size of the line buffer used when reading files
-#define LINE_BUFFER_SIZE 80
+// Size of the buffer /proc/meminfo is read into, the interesting keys come
+// first and a longer file is cut short
+#define MEMINFO_BUFFER_SIZE 4096
+
+// Default location of the proc filesystem, see taskSetProcRoot()
+#define PROC_ROOT        "/proc"
+// Size of the buffer for the path of a file below the proc root
+#define PATH_BUFFER_SIZE 256
 
 // Interesting keys in /proc/meminfo
 #define MEM_KEY_TOTAL    "MemTotal:"
 #define MEM_KEY_FREE     "MemFree:"
 #define MEM_KEY_BUFFERS  "Buffers:"
 #define MEM_KEY_CACHED   "Cached:"
+// Number of the interesting keys, parsing stops once all of them are found
+#define MEM_KEY_COUNT    4
 
 // CPU usage measurement period
 // Make the interval very long so it is noticeable (for demonstration purposes)
 #define MEASUREMENT_INTERVAL_US 1000000
 
+// State of the periodic sampling, see taskSampleCpu()
+static long sampleWorking = -1;
+static long sampleIdle = 0;
+static float sampledCpuUsage = 0;
+static long sampledMemoryKb = 0;
+
+// Directory the metrics are read from
+static const char *procRoot = PROC_ROOT;
+
+void taskSetProcRoot(const char *root)
+{
+  procRoot = root;
+}
+
+const char *taskGetProcRoot()
+{
+  return procRoot;
+}
+
 /**
- * @brief Retrieves information about current memory usage.
+ * @brief Opens a file below the proc root for reading, exits on failure.
  *
- * Parses the /proc/meminfo file and outputs the number of kB currently used.
- * Note: current implementation does not expect a malformed meminfo file
- *
- * @returns The number of kB currently used on the machine.
+ * @param name The file name relative to the proc root, e.g. "meminfo".
+ * @returns The open file.
  */
-long taskGetUsedMemoryKb()
+FILE *openProcFile(const char *name)
 {
-  long result = 0;
-  
-  // open the file
-  FILE *file = fopen("/proc/meminfo", "r");
+  char path[PATH_BUFFER_SIZE];
+
+  snprintf(path, sizeof(path), "%s/%s", procRoot, name);
+  FILE *file = fopen(path, "r");
   if (!file) {
     die("fopen()", ErrFile);
   }
-  
-  // iterate through all the lines
-  char *line = NULL;
-  size_t size = 0;
-  while (getline(&line, &size, file) > 0) {
-    if (line == NULL) {
-      fclose(file);
-      die("getline()", ErrFile);
-    }
+  return file;
+}
+
+/**
+ * @brief Reads the beginning of a file below the proc root, exits on failure.
+ *
+ * Unlike openProcFile() nothing is allocated.
+ *
+ * @param name The file name relative to the proc root, e.g. "meminfo".
+ * @param buffer The buffer, the data are terminated.
+ * @param size The size of the buffer.
+ * @returns The number of bytes read.
+ */
+int readProcFile(const char *name, char *buffer, int size)
+{
+  char path[PATH_BUFFER_SIZE];
 
-    // parse the line as key value pair
-    char key[LINE_BUFFER_SIZE];
-    long value;
-    if (sscanf(line, MEMINFO_FORMAT , key, &value) != 2) {
-      free(line);
-      line = NULL;
+  snprintf(path, sizeof(path), "%s/%s", procRoot, name);
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    die("open()", ErrFile);
+  }
+
+  int length = 0;
+  while (length < size - 1) {
+    ssize_t count = read(fd, buffer + length, size - 1 - length);
+    if (count < 0 && errno == EINTR) {
       continue;
     }
-    
-    // use interesting keys for the computation
-    if (strcmp(key, MEM_KEY_TOTAL) == 0) {
-      result += value;
+    if (count < 0) {
+      close(fd);
+      die("read()", ErrFile);
     }
-    if (strcmp(key, MEM_KEY_FREE) == 0 ||
-        strcmp(key, MEM_KEY_BUFFERS) == 0 ||
-        strcmp(key, MEM_KEY_CACHED) == 0) 
-    {
-      result -= value;
+    if (count == 0) {
+      break;
     }
-    
-    free(line);
-    line = NULL;
+    length += count;
+  }
+  close(fd);
+  buffer[length] = '\0';
+  return length;
+}
+
+/**
+ * @brief Compares the key of a meminfo line.
+ *
+ * @param line The line.
+ * @param length The length of the key, including the colon.
+ * @param key The key.
+ * @returns Nonzero if the line has the key.
+ */
+int isMemKey(const char *line, int length, const char *key)
+{
+  return length == (int) strlen(key) && memcmp(line, key, length) == 0;
+}
+
+/**
+ * @brief Retrieves information about current memory usage.
+ *
+ * Parses the /proc/meminfo file and outputs the number of kB currently used.
+ * The file is read into a static buffer and parsed in place, nothing is
+ * allocated. Lines without a colon are skipped.
+ *
+ * @returns The number of kB currently used on the machine.
+ */
+long taskGetUsedMemoryKb()
+{
+  static char buffer[MEMINFO_BUFFER_SIZE];
+  long result = 0;
+  int found = 0;
+
+  readProcFile("meminfo", buffer, sizeof(buffer));
+
+  // every line is "<key>: <value> kB"
+  char *line = buffer;
+  while (*line != '\0' && found < MEM_KEY_COUNT) {
+    char *end = strchrnul(line, '\n');
+    char *colon = memchr(line, ':', end - line);
+    if (colon) {
+      int length = colon + 1 - line;
+      long value = strtol(colon + 1, NULL, 10);
+
+      // use interesting keys for the computation
+      if (isMemKey(line, length, MEM_KEY_TOTAL)) {
+        result += value;
+        found++;
+      }
+      else if (isMemKey(line, length, MEM_KEY_FREE) ||
+               isMemKey(line, length, MEM_KEY_BUFFERS) ||
+               isMemKey(line, length, MEM_KEY_CACHED))
+      {
+        result -= value;
+        found++;
+      }
+    }
+    line = *end == '\n' ? end + 1 : end;
   }
-  free(line);
- 
-  fclose(file);
   return result;
 }
 
@@ -95,10 +180,7 @@ long taskGetUsedMemoryKb()
  */
 void getCpuUsage(long *timeWorking, long *timeIdle)
 {
-  FILE *file = fopen("/proc/stat", "r");
-  if (!file) {
-    die("fopen()", ErrFile);
-  }
+  FILE *file = openProcFile("stat");
   
   char *line = NULL;
   size_t size = 0;
@@ -141,4 +223,32 @@ float taskGetCpuUsage()
   long deltaTimeTotal = (workingB + idleB) - (workingA + idleA);
   
   return (float) deltaTimeWorking / deltaTimeTotal;
-}
\ No newline at end of file
+}
+
+void taskSampleCpu()
+{
+  long working, idle;
+  getCpuUsage(&working, &idle);
+
+  long deltaTimeTotal = (working + idle) - (sampleWorking + sampleIdle);
+  if (sampleWorking >= 0 && deltaTimeTotal > 0) {
+    sampledCpuUsage = (float) (working - sampleWorking) / deltaTimeTotal;
+  }
+  sampleWorking = working;
+  sampleIdle = idle;
+}
+
+float taskGetSampledCpuUsage()
+{
+  return sampledCpuUsage;
+}
+
+void taskSampleMemory()
+{
+  sampledMemoryKb = taskGetUsedMemoryKb();
+}
+
+long taskGetSampledMemoryKb()
+{
+  return sampledMemoryKb;
+}
@@ -8,6 +8,24 @@
 #ifndef _TASKS_H_
 #define _TASKS_H_
 
+/**
+ * @brief Sets the directory the metrics are read from instead of /proc.
+ *
+ * Meant for testing and benchmarking the parsers against captured snapshots.
+ * Applies to the process list and the per-core CPU times of the NUMA
+ * samplers as well, the node topology and memory still come from /sys.
+ *
+ * @param root The directory, must stay valid. It holds "meminfo" and "stat".
+ */
+void taskSetProcRoot(const char *root);
+
+/**
+ * @brief Returns the directory the metrics are read from.
+ *
+ * @returns "/proc" unless taskSetProcRoot() was called.
+ */
+const char *taskGetProcRoot();
+
 /**
  * @brief Retrieves information about current memory usage.
  *
@@ -25,4 +43,34 @@ long taskGetUsedMemoryKb();
  */
 float taskGetCpuUsage();
 
+/**
+ * @brief Takes a CPU time sample for taskGetSampledCpuUsage().
+ *
+ * Meant to be called periodically, the usage is computed between the last two calls.
+ */
+void taskSampleCpu();
+
+/**
+ * @brief Outputs the total CPU usage between the last two taskSampleCpu() calls.
+ *
+ * Unlike taskGetCpuUsage() this function returns immediately.
+ *
+ * @returns CPU usage in the range 0 - 1.0, or 0 until two samples are taken.
+ */
+float taskGetSampledCpuUsage();
+
+/**
+ * @brief Reads the memory usage for taskGetSampledMemoryKb().
+ *
+ * Meant to be called periodically along with taskSampleCpu().
+ */
+void taskSampleMemory();
+
+/**
+ * @brief Outputs the memory usage read by the last taskSampleMemory() call.
+ *
+ * @returns The number of kB used, or 0 until the first sample is taken.
+ */
+long taskGetSampledMemoryKb();
+
 #endif
\ No newline at end of file
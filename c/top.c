@@ -0,0 +1,503 @@
+/**
+ * @file top.c
+ * @brief Finds the processes using the most CPU or memory.
+ *
+ * The PIDs listed in /proc are split among a few threads, each of them reads
+ * /proc/[pid]/stat of its share and keeps its own bounded heap of the best
+ * candidates, the heaps are merged at the end.
+ *
+ * To compute CPU usage without sleeping, the CPU time of every process is
+ * remembered until the next scan in an open addressing hash table keyed by PID.
+ * There are two tables: the previous scan is looked up in one while the current
+ * scan is stored into the other, then they swap roles. Both live in a shared
+ * mapping, so the scans done by the forked workers build on each other.
+ *
+ * @author Karel Dolezal, akwky@centrum.cz
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "common.h"
+#include "tasks.h"
+#include "top.h"
+
+// Number of threads reading the process files
+#define TOP_THREADS      4
+// Number of PIDs a thread takes at once
+#define TOP_CHUNK_SIZE   256
+// Slots of a hash table, a power of two well above the expected process count
+#define TOP_TABLE_SIZE   131072
+// Size of the buffer for /proc/[pid]/stat, the fields needed are near its start
+#define STAT_BUFFER_SIZE 512
+// Index of the last /proc/[pid]/stat field needed (rss), counted from one
+#define STAT_LAST_FIELD  24
+// Size of the buffer for the path of a file below the proc root
+#define PATH_BUFFER_SIZE 256
+
+/**
+ * CPU time of a process seen by a scan, pid 0 marks a free slot.
+ */
+struct pidSlot
+{
+  int32_t pid;
+  uint32_t reserved;
+  uint64_t cpuTicks;
+};
+
+/**
+ * The state kept between scans, shared with the workers.
+ */
+struct topState
+{
+  pthread_mutex_t lock;   // held for the whole scan
+  int previous;           // index of the table holding the previous scan
+  long previousScanMs;    // nowMs() of the previous scan, 0 if none
+  struct pidSlot tables[2][TOP_TABLE_SIZE];
+};
+
+/**
+ * The work shared by the threads of one scan.
+ */
+struct scan
+{
+  enum topOrder order;
+  int count;
+  int *pids;
+  int pidCount;
+  int next;                       // the next PID to take, updated atomically
+  struct pidSlot *previous;       // NULL if there is no previous scan
+  struct pidSlot *current;
+  double elapsedTicks;            // clock ticks since the previous scan
+  double uptimeTicks;             // clock ticks since the boot
+  long ticksPerSecond;
+  long pageKb;
+};
+
+/**
+ * The candidates found by one thread.
+ */
+struct heap
+{
+  struct topEntry entries[TOP_MAX_COUNT];
+  int size;
+};
+
+static struct topState *state = NULL;
+
+void topInit()
+{
+  state = mmap(NULL, sizeof(*state), PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (state == MAP_FAILED) {
+    die("mmap()", ErrProcess);
+  }
+
+  // a worker killed in the middle of a scan must not block the others forever
+  pthread_mutexattr_t attributes;
+  pthread_mutexattr_init(&attributes);
+  pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(&state->lock, &attributes);
+  pthread_mutexattr_destroy(&attributes);
+}
+
+/**
+ * @brief Returns the first slot of a PID, the table is probed linearly from it.
+ */
+unsigned slotOf(int pid)
+{
+  return ((uint32_t) pid * 2654435761u) & (TOP_TABLE_SIZE - 1);
+}
+
+/**
+ * @brief Looks up the CPU time of a process.
+ *
+ * @param table The hash table.
+ * @param pid The process.
+ * @param cpuTicks The CPU time is stored here if found.
+ * @returns Nonzero if found.
+ */
+int tableFind(const struct pidSlot *table, int pid, uint64_t *cpuTicks)
+{
+  for (unsigned i = slotOf(pid), probes = 0; probes < TOP_TABLE_SIZE;
+       i = (i + 1) & (TOP_TABLE_SIZE - 1), probes++)
+  {
+    if (table[i].pid == pid) {
+      *cpuTicks = table[i].cpuTicks;
+      return 1;
+    }
+    if (table[i].pid == 0) {
+      return 0;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Stores the CPU time of a process, may be called by several threads at once.
+ *
+ * A full table is not an error, the process then reports its lifetime average
+ * on the next scan.
+ *
+ * @param table The hash table.
+ * @param pid The process, stored at most once per scan.
+ * @param cpuTicks The CPU time.
+ */
+void tableInsert(struct pidSlot *table, int pid, uint64_t cpuTicks)
+{
+  for (unsigned i = slotOf(pid), probes = 0; probes < TOP_TABLE_SIZE;
+       i = (i + 1) & (TOP_TABLE_SIZE - 1), probes++)
+  {
+    int32_t expected = 0;
+    if (__atomic_compare_exchange_n(&table[i].pid, &expected, pid, 0,
+          __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+      table[i].cpuTicks = cpuTicks;
+      return;
+    }
+  }
+}
+
+/**
+ * @brief Returns the value a heap is ordered by.
+ */
+double keyOf(const struct topEntry *entry, enum topOrder order)
+{
+  return order == TopByCpu ? entry->cpuPercent : entry->memoryKb;
+}
+
+/**
+ * @brief Offers a process to a min-heap holding at most count entries.
+ *
+ * @param heap The heap.
+ * @param count The capacity.
+ * @param order The resource to order by.
+ * @param entry The process.
+ */
+void heapOffer(struct heap *heap, int count, enum topOrder order,
+  const struct topEntry *entry)
+{
+  double key = keyOf(entry, order);
+  int i;
+
+  if (heap->size < count) {
+    // sift up from the new leaf
+    i = heap->size++;
+    while (i > 0 && keyOf(&heap->entries[(i - 1) / 2], order) > key) {
+      heap->entries[i] = heap->entries[(i - 1) / 2];
+      i = (i - 1) / 2;
+    }
+    heap->entries[i] = *entry;
+    return;
+  }
+  if (count == 0 || key <= keyOf(&heap->entries[0], order)) {
+    return;
+  }
+
+  // replace the smallest one and sift down from the root
+  i = 0;
+  for (;;) {
+    int child = 2 * i + 1;
+    if (child >= heap->size) {
+      break;
+    }
+    if (child + 1 < heap->size &&
+        keyOf(&heap->entries[child + 1], order) < keyOf(&heap->entries[child], order))
+    {
+      child++;
+    }
+    if (keyOf(&heap->entries[child], order) >= key) {
+      break;
+    }
+    heap->entries[i] = heap->entries[child];
+    i = child;
+  }
+  heap->entries[i] = *entry;
+}
+
+/**
+ * @brief Reads and parses /proc/[pid]/stat.
+ *
+ * The resident set size is taken from the stat line as well, it is the same
+ * value /proc/[pid]/statm reports, and saves opening a second file.
+ *
+ * @param pid The process.
+ * @param entry The name and the memory usage are stored here.
+ * @param cpuTicks The user and system CPU time is stored here.
+ * @param startTicks The start time since the boot is stored here.
+ * @param pageKb The page size in kB.
+ * @returns Zero on success, -1 if the process is gone or the file is malformed.
+ */
+int readStat(int pid, struct topEntry *entry, uint64_t *cpuTicks,
+  uint64_t *startTicks, long pageKb)
+{
+  char path[PATH_BUFFER_SIZE];
+  char buffer[STAT_BUFFER_SIZE];
+
+  snprintf(path, sizeof(path), "%s/%d/stat", taskGetProcRoot(), pid);
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+  int size = read(fd, buffer, sizeof(buffer) - 1);
+  close(fd);
+  if (size <= 0) {
+    return -1;
+  }
+  buffer[size] = '\0';
+
+  // the name is in parentheses and may contain anything, even ')'
+  char *nameStart = strchr(buffer, '(');
+  char *nameEnd = strrchr(buffer, ')');
+  if (!nameStart || !nameEnd || nameEnd < nameStart || nameEnd[1] != ' ') {
+    return -1;
+  }
+  int nameLength = nameEnd - nameStart - 1;
+  if (nameLength >= TOP_NAME_SIZE) {
+    nameLength = TOP_NAME_SIZE - 1;
+  }
+  memcpy(entry->name, nameStart + 1, nameLength);
+  entry->name[nameLength] = '\0';
+
+  // the state is field 3, numeric fields follow
+  char *position = nameEnd + 4;
+  uint64_t utime = 0, stime = 0, start = 0, rss = 0;
+  for (int field = 4; field <= STAT_LAST_FIELD; field++) {
+    char *end;
+    long long value = strtoll(position, &end, 10);
+    if (end == position) {
+      return -1;
+    }
+    position = end;
+    switch (field) {
+      case 14: utime = value; break;
+      case 15: stime = value; break;
+      case 22: start = value; break;
+      case 24: rss = value; break;
+    }
+  }
+
+  entry->pid = pid;
+  entry->memoryKb = rss * pageKb;
+  *cpuTicks = utime + stime;
+  *startTicks = start;
+  return 0;
+}
+
+/**
+ * @brief Thread body, processes chunks of PIDs until there are none left.
+ *
+ * @param data The struct scan.
+ * @returns A struct heap of the candidates, NULL on allocation failure.
+ */
+void *scanThread(void *data)
+{
+  struct scan *scan = (struct scan *) data;
+  struct heap *heap = calloc(1, sizeof(*heap));
+  if (!heap) {
+    return NULL;
+  }
+
+  for (;;) {
+    int first = __atomic_fetch_add(&scan->next, TOP_CHUNK_SIZE, __ATOMIC_RELAXED);
+    if (first >= scan->pidCount) {
+      break;
+    }
+    int last = first + TOP_CHUNK_SIZE;
+    if (last > scan->pidCount) {
+      last = scan->pidCount;
+    }
+
+    for (int i = first; i < last; i++) {
+      struct topEntry entry;
+      uint64_t cpuTicks, startTicks, previousTicks;
+      if (readStat(scan->pids[i], &entry, &cpuTicks, &startTicks, scan->pageKb) != 0) {
+        continue;
+      }
+      tableInsert(scan->current, entry.pid, cpuTicks);
+
+      if (scan->previous && tableFind(scan->previous, entry.pid, &previousTicks) &&
+          previousTicks <= cpuTicks)
+      {
+        entry.cpuPercent = 100.0 * (cpuTicks - previousTicks) / scan->elapsedTicks;
+      }
+      else {
+        // new since the previous scan (or a reused PID), use the lifetime average
+        double age = scan->uptimeTicks - startTicks;
+        entry.cpuPercent = age > 0 ? 100.0 * cpuTicks / age : 0;
+      }
+      heapOffer(heap, scan->count, scan->order, &entry);
+    }
+  }
+  return heap;
+}
+
+/**
+ * @brief Lists the numeric entries of /proc.
+ *
+ * @param count The number of PIDs is stored here.
+ * @returns An allocated array of PIDs, NULL on error.
+ */
+int *listPids(int *count)
+{
+  DIR *directory = opendir(taskGetProcRoot());
+  if (!directory) {
+    return NULL;
+  }
+
+  int capacity = 1024;
+  int *pids = malloc(capacity * sizeof(*pids));
+  *count = 0;
+  struct dirent *item;
+  while (pids && (item = readdir(directory)) != NULL) {
+    if (item->d_name[0] < '1' || item->d_name[0] > '9') {
+      continue;
+    }
+    if (*count == capacity) {
+      capacity *= 2;
+      int *bigger = realloc(pids, capacity * sizeof(*pids));
+      if (!bigger) {
+        free(pids);
+        pids = NULL;
+        break;
+      }
+      pids = bigger;
+    }
+    pids[(*count)++] = atoi(item->d_name);
+  }
+  closedir(directory);
+  return pids;
+}
+
+/**
+ * @brief Returns the time since the boot from /proc/uptime.
+ *
+ * @returns Seconds, 0 on error.
+ */
+double readUptime()
+{
+  char path[PATH_BUFFER_SIZE];
+  double uptime = 0;
+
+  snprintf(path, sizeof(path), "%s/uptime", taskGetProcRoot());
+  FILE *file = fopen(path, "r");
+  if (file) {
+    if (fscanf(file, "%lf", &uptime) != 1) {
+      uptime = 0;
+    }
+    fclose(file);
+  }
+  return uptime;
+}
+
+// The order used by compareEntries()
+static enum topOrder sortOrder;
+
+/**
+ * @brief qsort() comparator putting the larger values first.
+ */
+int compareEntries(const void *a, const void *b)
+{
+  double x = keyOf(a, sortOrder), y = keyOf(b, sortOrder);
+  return (x < y) - (x > y);
+}
+
+int topScan(enum topOrder order, int count, struct topEntry *entries)
+{
+  struct scan scan;
+  pthread_t threads[TOP_THREADS];
+  struct heap result;
+
+  if (count > TOP_MAX_COUNT) {
+    count = TOP_MAX_COUNT;
+  }
+  memset(&scan, 0, sizeof(scan));
+  scan.order = order;
+  scan.count = count;
+  scan.ticksPerSecond = sysconf(_SC_CLK_TCK);
+  scan.pageKb = sysconf(_SC_PAGESIZE) / 1024;
+  scan.uptimeTicks = readUptime() * scan.ticksPerSecond;
+  scan.pids = listPids(&scan.pidCount);
+  if (!scan.pids) {
+    return -1;
+  }
+
+  int error = pthread_mutex_lock(&state->lock);
+  if (error == EOWNERDEAD) {
+    // the tables are rebuilt by every scan, nothing to repair
+    pthread_mutex_consistent(&state->lock);
+  }
+  else if (error != 0) {
+    free(scan.pids);
+    return -1;
+  }
+
+  long now = nowMs();
+  if (state->previousScanMs && now > state->previousScanMs) {
+    scan.previous = state->tables[state->previous];
+    scan.elapsedTicks = (double) (now - state->previousScanMs) * scan.ticksPerSecond / 1000;
+  }
+  scan.current = state->tables[!state->previous];
+  memset(scan.current, 0, sizeof(state->tables[0]));
+
+  int threadCount = sysconf(_SC_NPROCESSORS_ONLN);
+  if (threadCount < 1) {
+    threadCount = 1;
+  }
+  if (threadCount > TOP_THREADS) {
+    threadCount = TOP_THREADS;
+  }
+  struct heap *heaps[TOP_THREADS];
+  int started = 0;
+  while (started < threadCount &&
+         pthread_create(&threads[started], NULL, scanThread, &scan) == 0)
+  {
+    started++;
+  }
+  int heapCount = started;
+  if (started == 0) {
+    // with no thread available do the work here
+    heaps[heapCount++] = scanThread(&scan);
+  }
+  for (int i = 0; i < started; i++) {
+    void *heap;
+    pthread_join(threads[i], &heap);
+    heaps[i] = heap;
+  }
+
+  int failed = 0;
+  memset(&result, 0, sizeof(result));
+  for (int i = 0; i < heapCount; i++) {
+    for (int j = 0; heaps[i] && j < heaps[i]->size; j++) {
+      heapOffer(&result, count, order, &heaps[i]->entries[j]);
+    }
+    failed |= !heaps[i];
+    free(heaps[i]);
+  }
+
+  if (!failed) {
+    state->previous = !state->previous;
+    state->previousScanMs = now;
+  }
+  pthread_mutex_unlock(&state->lock);
+  free(scan.pids);
+  if (failed) {
+    return -1;
+  }
+
+  sortOrder = order;
+  qsort(result.entries, result.size, sizeof(result.entries[0]), compareEntries);
+  memcpy(entries, result.entries, result.size * sizeof(result.entries[0]));
+  return result.size;
+}
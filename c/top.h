@@ -0,0 +1,57 @@
+/**
+ * @file top.h
+ * @brief Finds the processes using the most CPU or memory.
+ *
+ * @author Karel Dolezal, akwky@centrum.cz
+ */
+
+#ifndef _TOP_H_
+#define _TOP_H_
+
+// Maximum number of processes a scan can report
+#define TOP_MAX_COUNT 50
+// Size of the process name, as limited by the kernel (TASK_COMM_LEN)
+#define TOP_NAME_SIZE 16
+
+/**
+ * The criterion for ordering the processes.
+ */
+enum topOrder
+{
+  TopByCpu = 0,
+  TopByMemory,
+};
+
+/**
+ * A process found by the scan.
+ */
+struct topEntry
+{
+  int pid;
+  char name[TOP_NAME_SIZE];
+  float cpuPercent;     // of one core, since the previous scan (or the process start)
+  long memoryKb;        // resident set size
+};
+
+/**
+ * @brief Allocates the state kept between scans.
+ *
+ * The state is placed in memory shared with forked children, so it must be
+ * initialized before the first fork().
+ */
+void topInit();
+
+/**
+ * @brief Scans all processes and returns those using the most of the resource.
+ *
+ * CPU usage is computed from the CPU time consumed since the previous scan,
+ * by any process. Processes started after it report their lifetime average.
+ *
+ * @param order The resource to order by.
+ * @param count The number of processes to return, at most TOP_MAX_COUNT.
+ * @param entries The processes are stored here, in descending order.
+ * @returns The number of processes stored, -1 on error.
+ */
+int topScan(enum topOrder order, int count, struct topEntry *entries);
+
+#endif
@@ -0,0 +1,113 @@
+/**
+ * @file trace.c
+ * @brief Binary trace of the request arrivals.
+ *
+ * Only the listening process records, the records are collected in a static
+ * buffer and written by plain write() calls, so forked workers never flush
+ * the records they inherited. A failed write stops the tracing, the daemon
+ * keeps serving.
+ *
+ * @author Karel Dolezal, akwky@centrum.cz
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+
+#include "common.h"
+#include "trace.h"
+
+// Number of records buffered before they are written, 4 kB
+#define TRACE_BUFFER_RECORDS 128
+
+static int traceFd = -1;
+static long long startUs;
+static struct traceRecord records[TRACE_BUFFER_RECORDS];
+static int recordCount = 0;
+
+/**
+ * @brief Writes the whole buffer, stops the tracing on failure.
+ *
+ * @param data The data.
+ * @param size The number of bytes.
+ */
+void writeTrace(const void *data, size_t size)
+{
+  const char *bytes = (const char *) data;
+  while (size > 0 && traceFd >= 0) {
+    ssize_t written = write(traceFd, bytes, size);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      printf("%d: Cannot write the trace, tracing stopped. %s\n", getpid(), strerror(errno));
+      close(traceFd);
+      traceFd = -1;
+      return;
+    }
+    bytes += written;
+    size -= written;
+  }
+}
+
+void traceOpen(const char *path)
+{
+  traceFd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (traceFd < 0) {
+    die("open()", ErrFile);
+  }
+
+  struct traceHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = TRACE_MAGIC;
+  header.version = TRACE_VERSION;
+  header.recordSize = sizeof(struct traceRecord);
+  header.startUs = clockNs(CLOCK_REALTIME) / 1000;
+  startUs = clockNs(CLOCK_MONOTONIC) / 1000;
+  writeTrace(&header, sizeof(header));
+}
+
+void traceRequest(int transport, const struct sockaddr *peer, const char *request, int size)
+{
+  if (traceFd < 0) {
+    return;
+  }
+
+  struct traceRecord *record = &records[recordCount];
+  memset(record, 0, sizeof(*record));
+  record->offsetUs = clockNs(CLOCK_MONOTONIC) / 1000 - startUs;
+  record->transport = transport;
+  if (peer && peer->sa_family == AF_INET) {
+    const struct sockaddr_in *address = (const struct sockaddr_in *) peer;
+    record->peerAddress = address->sin_addr.s_addr;
+    record->peerPort = address->sin_port;
+  }
+
+  // the first line, without the line ending, its length tells a truncated one
+  int length = 0;
+  while (length < size && length < UINT8_MAX &&
+         request[length] != '\n' && request[length] != '\r' && request[length] != '\0')
+  {
+    length++;
+  }
+  memcpy(record->command, request, length < TRACE_COMMAND_SIZE ? length : TRACE_COMMAND_SIZE);
+  record->commandSize = length;
+
+  if (++recordCount == TRACE_BUFFER_RECORDS) {
+    traceFlush();
+  }
+}
+
+void traceFlush()
+{
+  if (recordCount > 0) {
+    writeTrace(records, recordCount * sizeof(struct traceRecord));
+    recordCount = 0;
+  }
+}
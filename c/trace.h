@@ -0,0 +1,88 @@
+/**
+ * @file trace.h
+ * @brief Binary trace of the request arrivals, see the "-T" option of the server.
+ *
+ * The file starts with a struct traceHeader followed by struct traceRecord
+ * entries in arrival order. All fields are naturally aligned, in host byte
+ * order unless noted. The replay tool of the C++ client reads the same layout
+ * (cpp/trace.hpp), keep both in sync.
+ *
+ * @author Karel Dolezal, akwky@centrum.cz
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+// Identifies a trace file, "RQTR" in memory on little endian hosts
+#define TRACE_MAGIC   0x52545152
+// Layout version described by struct traceRecord
+#define TRACE_VERSION 2
+// Number of request bytes kept, longer requests are truncated
+#define TRACE_COMMAND_SIZE 16
+
+/**
+ * How a traced request arrived.
+ */
+enum traceTransport
+{
+  TraceTcp = 0,       // line protocol over TCP, one request per connection
+  TraceUnix,          // line protocol over a Unix domain socket
+  TraceUdp,           // line protocol datagram
+  TraceHttp,          // HTTP request, the command is the start of the request line
+  TraceSession,       // a request within a session, over TCP or a Unix socket
+};
+
+/**
+ * The file header.
+ */
+struct traceHeader
+{
+  uint32_t magic;           // TRACE_MAGIC
+  uint16_t version;         // TRACE_VERSION
+  uint16_t recordSize;      // sizeof(struct traceRecord) of the writer
+  uint64_t startUs;         // wall clock time the trace started, microseconds since the epoch
+};
+
+/**
+ * One request arrival, 32 bytes.
+ */
+struct traceRecord
+{
+  uint64_t offsetUs;        // CLOCK_MONOTONIC microseconds since the trace started
+  uint32_t peerAddress;     // IPv4 address in network byte order, 0 for Unix sockets
+  uint16_t peerPort;        // in network byte order, 0 for Unix sockets
+  uint8_t transport;        // enum traceTransport
+  uint8_t commandSize;      // whole request length up to 255, truncated above TRACE_COMMAND_SIZE
+  char command[TRACE_COMMAND_SIZE];   // the request without the newline, not terminated
+};
+
+/**
+ * @brief Creates the trace file, replacing an existing one, and writes the header.
+ *
+ * @param path The file path.
+ */
+void traceOpen(const char *path);
+
+/**
+ * @brief Records a complete request. Does nothing unless the trace is open.
+ *
+ * Records are buffered, see traceFlush().
+ *
+ * @param transport The enum traceTransport.
+ * @param peer The client address, may be NULL.
+ * @param request The request, only its first line is kept.
+ * @param size The number of request bytes.
+ */
+void traceRequest(int transport, const struct sockaddr *peer, const char *request, int size);
+
+/**
+ * @brief Writes the buffered records to the file.
+ *
+ * Must not be called in forked children, they would repeat the parent's records.
+ */
+void traceFlush();
+
+#endif
@@ -11,6 +11,7 @@
 
 using namespace std;
  
+#include <cstring>
 #include <string>
 #include <map>
 
@@ -26,6 +27,7 @@ Arguments::Arguments(int argc, char *argv[])
 {
   v_argc = argc;
   v_argv = argv;
+  v_udp = false;
 }
 
 /**
@@ -34,7 +36,9 @@ Arguments::Arguments(int argc, char *argv[])
  */
 bool Arguments::parse()
 {
-  if (v_argc != 3) {
+  // the optional transport switch precedes the command switch
+  v_udp = v_argc == 4 && string(v_argv[2]) == "-u";
+  if (v_argc != 3 + v_udp) {
     return false;
   }
 
@@ -42,17 +46,30 @@ bool Arguments::parse()
   map<string, string> cmdMap;
   cmdMap.insert(make_pair("-c", CMD_CPU));
   cmdMap.insert(make_pair("-m", CMD_MEM));
+  cmdMap.insert(make_pair("-s", CMD_STATS));
+  cmdMap.insert(make_pair("-l", CMD_HOSTS));
+  cmdMap.insert(make_pair("-a", CMD_CLUSTER));
+  cmdMap.insert(make_pair("-t", CMD_TOP_CPU));
+  cmdMap.insert(make_pair("-T", CMD_TOP_MEM));
+  cmdMap.insert(make_pair("-P", CMD_PROFILE));
+  cmdMap.insert(make_pair("-n", CMD_NODE_CPU));
+  cmdMap.insert(make_pair("-N", CMD_NODE_MEM));
   // @JP@ the following construction would consume less CPU cycles and reduce a need of copying:
   //const auto cmdMap1 = map<string, string>{{"-c", CMD_CPU},{"-m", CMD_MEM}};
 
   // translate the command switch to command string
-  map<string, string>::iterator it = cmdMap.find(v_argv[2]);
+  map<string, string>::iterator it = cmdMap.find(v_argv[v_argc - 1]);
   if (it == cmdMap.end()) {
     return false;
   }
   
   v_command = string(it->second);
   v_host = string(v_argv[1]);
+
+  // there is no datagram transport for Unix domain sockets
+  if (v_udp && v_host.compare(0, strlen(UNIX_PREFIX), UNIX_PREFIX) == 0) {
+    return false;
+  }
   return true;
 }
 
@@ -60,7 +77,7 @@ bool Arguments::parse()
  * @brief Returns the extracted host name.
  * @returns The name of the host to connect to.
  */
-string Arguments::host() 
+string Arguments::host() const
 {
   return v_host;
 }
@@ -69,8 +86,17 @@ string Arguments::host()
  * @brief Returns the extracted command.
  * @returns The command to be sent to the server.
  */
-string Arguments::command()
+string Arguments::command() const
 {
   return v_command;
 }
 
+/**
+ * @brief Tells whether the request should be sent over UDP.
+ * @returns True for UDP, false for TCP.
+ */
+bool Arguments::udp() const
+{
+  return v_udp;
+}
+
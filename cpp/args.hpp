@@ -24,6 +24,7 @@ public:
   
   std::string host() const;
   std::string command() const;
+  bool udp() const;
   
 private:
   /// Source data
@@ -33,6 +34,7 @@ private:
   /// Processed data
   std::string v_host;
   std::string v_command;
+  bool v_udp;
 };
 
 #endif
\ No newline at end of file
@@ -16,7 +16,7 @@
 #include "crp.hpp"
 #include "args.hpp"
 
-#define USAGE "Usage: client <server> (-c | -m)\n"
+#define USAGE "Usage: client <server[:port] | unix:/path | unix:@name> [-u] (-c | -m | -s | -l | -a | -t | -T | -P | -n | -N)\n"
 
 using namespace boost::asio;
 using namespace std;
@@ -43,8 +43,17 @@ int main(int argc, char *argv[]) {
   
   // process the request
   try {
-    client.process(cout, args.host(), args.command());
+    if (args.udp()) {
+      client.processDatagram(cout, args.host(), args.command());
+    }
+    else {
+      client.process(cout, args.host(), args.command());
+    }
   } 
+  catch (const TimeoutError &ex) {
+    cerr << "Timeout: " << ex.what() << endl;
+    return ErrTimeout;
+  }
   catch (const std::exception &ex) {
     cerr << "Exception: " << ex.what() << endl;
     return ErrGeneral;
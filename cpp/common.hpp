@@ -11,9 +11,23 @@
 // All known commands supported by the server (and client).
 #define CMD_CPU     "cpu\n"
 #define CMD_MEM     "mem\n"
+#define CMD_STATS   "stats\n"
+#define CMD_HOSTS   "hosts\n"
+#define CMD_CLUSTER "cluster\n"
+#define CMD_PROFILE "profile\n"
+#define CMD_NODE_CPU "nodecpu\n"
+#define CMD_NODE_MEM "nodemem\n"
+// Prefix of "top <n> cpu|mem", listing the processes using the most of a resource.
+#define CMD_TOP     "top "
+#define CMD_TOP_CPU "top 10 cpu\n"
+#define CMD_TOP_MEM "top 10 mem\n"
 
 #define PORT        "5001"
 
+// Prefix of a server address selecting a Unix domain socket instead of TCP,
+// e.g. "unix:/run/daemon.sock" or "unix:@daemon" for the abstract namespace.
+#define UNIX_PREFIX "unix:"
+
 /**
  * Specifies exit codes for the programs. 
  * Only general type of error is reported, see error message in the log for details.
@@ -23,6 +37,7 @@ enum errorCode
   ErrOK = 0,
   ErrArgs,      // Invalid command line arguments
   ErrGeneral,   // General failure code (see exception text for more details)
+  ErrTimeout,   // A connect, send or receive deadline has expired
 };
 
 #endif
@@ -7,7 +7,10 @@
  * @author Karel Dolezal, akwky@centrum.cz
  */
  
+#include <cstring>
 #include <iostream>
+#include <string>
+#include <vector>
 #include <boost/asio.hpp>
 
 #include "common.hpp"
@@ -20,61 +23,213 @@
 using namespace boost::asio; 
 using namespace std;
 
+// Deadline for establishing the connection
+#define CONNECT_TIMEOUT_MS 3000
+// Deadline for sending the request and receiving the whole response.
+// The server measures CPU usage for a second, so keep this well above that.
+#define IO_TIMEOUT_MS      5000
+// Size of the buffer for a UDP response, which must arrive in one datagram.
+// The largest possible datagram fits, a longer one would be reported as truncated.
+#define DATAGRAM_BUFFER_SIZE 65536
+
 /**
  * Constructs the request processor
  * @param ioService An existing io_service instance for handling asio operations.
  */
 ClientRequestProcessor::ClientRequestProcessor(io_service *ioService) 
-  : v_resolver(*ioService)
+  : v_resolver(*ioService), v_timer(*ioService), v_timeouts(0)
 {
   v_ioService = ioService;
 }
 
+/**
+ * @brief Runs the io_service until the pending operation on the socket completes.
+ *
+ * The socket is closed when the deadline expires, which aborts the operation.
+ *
+ * @param socket The socket with a pending asynchronous operation.
+ * @param error Set by the operation's handler, would_block until it completes.
+ * @param timeoutMs The deadline in milliseconds from now.
+ * @param operation The operation name reported on timeout.
+ * @throws TimeoutError if the deadline expired
+ */
+template <typename Socket>
+void ClientRequestProcessor::waitForCompletion(Socket &socket, boost::system::error_code &error,
+  long timeoutMs, const char *operation)
+{
+  bool expired = false;
+  v_timer.expires_from_now(std::chrono::milliseconds(timeoutMs));
+  v_timer.async_wait([&](const boost::system::error_code &ec) {
+    if (!ec) {
+      expired = true;
+      socket.close();
+    }
+  });
+
+  v_ioService->reset();
+  while (error == boost::asio::error::would_block) {
+    v_ioService->run_one();
+  }
+
+  // let the cancelled timer handler run before its captures go out of scope
+  v_timer.cancel();
+  v_ioService->poll();
+
+  if (expired) {
+    v_timeouts++;
+    throw TimeoutError(string(operation) + " timed out");
+  }
+}
+
 /**
  * Sends request to the server and writes response to the given string
  * @param output Stream for writing the server's response
- * @param host Server hostname or address
+ * @param host Server hostname or address, or UNIX_PREFIX followed by a socket path
+ * @param command Command request
+ * @throws TimeoutError if the server does not respond in time
+ */
+void ClientRequestProcessor::process(ostream &output, const string &host, const string &command)
+{
+  if (host.compare(0, strlen(UNIX_PREFIX), UNIX_PREFIX) == 0) {
+    local::stream_protocol::endpoint endpoint = unixEndpoint(host.substr(strlen(UNIX_PREFIX)));
+    output << "Will connect to " << host << endl;
+    local::stream_protocol::socket socket(*v_ioService);
+    exchange(socket, endpoint, output, command);
+  }
+  else {
+    ip::tcp::endpoint endpoint = resolveHostname(host);
+    output << "Will connect to " << endpoint << endl;
+    ip::tcp::socket socket(*v_ioService);
+    exchange(socket, endpoint, output, command);
+  }
+}
+
+/**
+ * @brief Connects the stream socket, sends the request and reads the response.
+ * @param socket A stream socket, not connected yet
+ * @param endpoint The server endpoint
+ * @param output Stream for writing the server's response
  * @param command Command request
+ * @throws TimeoutError if the server does not respond in time
  */
-// @JP@ Hmm, hmm, passing strings by value can be appropriate for some specific cases,
-// when a move semantic is taking a place, but this is not that case. Here you're just wasting
-// resources, so the string should be passed by const reference.
-void ClientRequestProcessor::process(ostream &output, string host, string command)
+template <typename Socket>
+void ClientRequestProcessor::exchange(Socket &socket, const typename Socket::endpoint_type &endpoint,
+  ostream &output, const string &command)
 {
+  boost::system::error_code error;
+
   // connect to the server
-  ip::tcp::endpoint endpoint = resolveHostname(host);
-  output << "Will connect to " << endpoint << endl;
-  ip::tcp::socket socket(*v_ioService);
-  socket.connect(endpoint);
+  error = boost::asio::error::would_block;
+  socket.async_connect(endpoint, [&](const boost::system::error_code &ec) { 
+    error = ec; 
+  });
+  waitForCompletion(socket, error, CONNECT_TIMEOUT_MS, "connect");
+  if (error) {
+    throw runtime_error(error.message());
+  }
 
-  // write the request
-  write(socket, boost::asio::buffer(command), boost::asio::transfer_all());
+  // write the request and read the response, both within one deadline
+  error = boost::asio::error::would_block;
+  async_write(socket, boost::asio::buffer(command), transfer_all(), 
+    [&](const boost::system::error_code &ec, size_t) { 
+      error = ec; 
+    });
+  waitForCompletion(socket, error, IO_TIMEOUT_MS, "send");
+  if (error) {
+    throw runtime_error(error.message());
+  }
 
-  // read the response
   boost::asio::streambuf buf;
-  boost::system::error_code error;   
-  size_t len;
-  // @JP@ nitpick: maybe the similar overload, throwing an exception, in case of error, can be used here,
-  // rather than passing the error structure
-  while (len = read(socket, buf, transfer_all(), error) > 0) {
-    output << boost::asio::buffer_cast<const char*>(buf.data());
-  }
+  error = boost::asio::error::would_block;
+  async_read(socket, buf, transfer_all(), 
+    [&](const boost::system::error_code &ec, size_t) { 
+      error = ec; 
+    });
+  waitForCompletion(socket, error, IO_TIMEOUT_MS, "receive");
   if (error != boost::asio::error::eof) {
     // avoid exception handling during normal situations like EOF, but
     // throw on unexpected error code
     throw runtime_error(error.message());
   }
+  output << &buf;
+
+  socket.close();
+}
+
+/**
+ * Sends request to the server as a single datagram and writes the response
+ * datagram to the given stream. There are no retries, a truncated response
+ * datagram is an error.
+ * @param output Stream for writing the server's response
+ * @param host Server hostname or address
+ * @param command Command request
+ * @throws TimeoutError if the server does not respond in time
+ */
+void ClientRequestProcessor::processDatagram(ostream &output, const string &host, 
+  const string &command)
+{
+  boost::system::error_code error;
+
+  ip::tcp::endpoint resolved = resolveHostname(host);
+  ip::udp::endpoint endpoint(resolved.address(), resolved.port());
+  output << "Will send to " << endpoint << endl;
+  ip::udp::socket socket(*v_ioService);
+  socket.connect(endpoint);
+
+  error = boost::asio::error::would_block;
+  socket.async_send(boost::asio::buffer(command), 
+    [&](const boost::system::error_code &ec, size_t) { 
+      error = ec; 
+    });
+  waitForCompletion(socket, error, IO_TIMEOUT_MS, "send");
+  if (error) {
+    throw runtime_error(error.message());
+  }
+
+  vector<char> buf(DATAGRAM_BUFFER_SIZE);
+  size_t len = 0;
+  error = boost::asio::error::would_block;
+  // MSG_TRUNC reports the real length of a datagram longer than the buffer
+  socket.async_receive(boost::asio::buffer(buf), MSG_TRUNC,
+    [&](const boost::system::error_code &ec, size_t received) { 
+      error = ec; 
+      len = received;
+    });
+  waitForCompletion(socket, error, IO_TIMEOUT_MS, "receive");
+  if (error) {
+    throw runtime_error(error.message());
+  }
+  if (len > buf.size()) {
+    throw runtime_error("the response datagram of " + to_string(len) + " bytes was truncated");
+  }
+  output.write(buf.data(), len);
 
   socket.close();
 }
 
+/**
+ * @brief Returns the number of deadlines which have expired so far.
+ * @returns The timeout count.
+ */
+unsigned long ClientRequestProcessor::timeouts() const
+{
+  return v_timeouts;
+}
+
 /**
  * @brief Resolves the given host name.
+ * @param host Host name or address, optionally followed by ":port".
  * @returns The endpoint.
  */
 ip::tcp::endpoint ClientRequestProcessor::resolveHostname(string host)
 {
-  ip::tcp::resolver::query query(host, PORT);
+  string port = PORT;
+  size_t colon = host.find(':');
+  if (colon != string::npos) {
+    port = host.substr(colon + 1);
+    host.erase(colon);
+  }
+  ip::tcp::resolver::query query(host, port);
   ip::tcp::resolver::iterator i = v_resolver.resolve(query);
   ip::tcp::resolver::iterator end;
   if (i == end) {
@@ -82,5 +237,18 @@ ip::tcp::endpoint ClientRequestProcessor::resolveHostname(string host)
   }
   
   return *i;
-}  
-  
+}
+
+/**
+ * @brief Builds a Unix domain socket endpoint.
+ * @param path Filesystem path, or a name in the abstract namespace prefixed by '@'.
+ * @returns The endpoint.
+ */
+local::stream_protocol::endpoint ClientRequestProcessor::unixEndpoint(string path)
+{
+  if (!path.empty() && path[0] == '@') {
+    // abstract names start with a zero byte instead
+    path[0] = '\0';
+  }
+  return local::stream_protocol::endpoint(path);
+}
@@ -11,24 +11,48 @@
 #define _CRP_HPP_
 
 #include <iostream>
+#include <stdexcept>
 #include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+/**
+ * Thrown when a connect, send or receive deadline expires.
+ */
+class TimeoutError : public std::runtime_error
+{
+public:
+  explicit TimeoutError(const std::string &what) : std::runtime_error(what) {}
+};
 
 /**
  * Client-side request processor.
  * Connects to a specified server, sends given request and retrieves response.
+ * Every operation is bounded by a deadline, expired deadlines are counted.
  */
 class ClientRequestProcessor
 {
 public:
   ClientRequestProcessor(boost::asio::io_service *ioService);
  
-  void process(std::ostream &output, std::string host, std::string command);
+  void process(std::ostream &output, const std::string &host, const std::string &command);
+  void processDatagram(std::ostream &output, const std::string &host, const std::string &command);
+
+  unsigned long timeouts() const;
   
 private:
   boost::asio::io_service *v_ioService; // @JP@ hold as a reference
   boost::asio::ip::tcp::resolver v_resolver;
+  boost::asio::steady_timer v_timer;
+  unsigned long v_timeouts;
   
   boost::asio::ip::tcp::endpoint resolveHostname(std::string host);
+  boost::asio::local::stream_protocol::endpoint unixEndpoint(std::string path);
+  template <typename Socket>
+  void exchange(Socket &socket, const typename Socket::endpoint_type &endpoint,
+    std::ostream &output, const std::string &command);
+  template <typename Socket>
+  void waitForCompletion(Socket &socket, boost::system::error_code &error, long timeoutMs,
+    const char *operation);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,275 @@
+/**
+ * @file replay.cpp
+ * @brief Replays a request trace recorded by the server against a test daemon.
+ *
+ * Every request is issued at its recorded offset from the start, divided by the
+ * speed factor. A pool of threads, each with its own request processor, takes
+ * the requests in order, so a slow response does not delay the following
+ * requests as long as a thread is free. The latency is measured from the time
+ * the request was scheduled, not from when it was actually sent, so requests
+ * held back by a busy pool show up in the results instead of being hidden.
+ *
+ * Requests from sessions are sent one per connection. HTTP requests are skipped,
+ * and so are requests longer than TRACE_COMMAND_SIZE, which were truncated by
+ * the recording.
+ *
+ * @author Karel Dolezal, akwky@centrum.cz
+ */
+
+// Allowed libs: stl, boost (asio), pthread
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+
+#include "common.hpp"
+#include "crp.hpp"
+#include "trace.hpp"
+
+#define USAGE "Usage: replay [-s <speed>] [-j <threads>] <server[:port] | unix:/path | unix:@name> <trace file>\n"
+#define OPTION_SPEED   "-s"
+#define OPTION_THREADS "-j"
+// Number of requests which may be in progress at once unless specified
+#define DEFAULT_THREADS 16
+
+using namespace boost::asio;
+using namespace std;
+
+typedef std::chrono::steady_clock Clock;
+
+/**
+ * A request to replay and its outcome.
+ */
+struct Request
+{
+  string command;
+  string kind;                // reported group, see requestKind()
+  bool datagram;
+  Clock::duration offset;     // from the start of the replay, already scaled
+  // outcome
+  double latencyMs;           // from the scheduled time until the response
+  double lateMs;              // from the scheduled time until it was sent
+  bool failed;
+};
+
+/**
+ * @brief Groups the requests like the server's profile does.
+ * @param command The request line with the newline.
+ * @returns The group name.
+ */
+string requestKind(const string &command)
+{
+  static const char *const known[] = { CMD_CPU, CMD_MEM, CMD_STATS, CMD_HOSTS, CMD_CLUSTER,
+    CMD_PROFILE, CMD_NODE_CPU, CMD_NODE_MEM };
+  for (const char *name : known) {
+    if (command == name) {
+      return command.substr(0, command.size() - 1);
+    }
+  }
+  if (command.compare(0, strlen(CMD_TOP), CMD_TOP) == 0) {
+    return "top";
+  }
+  return "invalid";
+}
+
+/**
+ * @brief Reads the trace file.
+ * @param path The file path.
+ * @param speed The speed factor the offsets are divided by.
+ * @param requests The requests to replay are appended here.
+ * @param truncated The number of skipped truncated requests is stored here.
+ * @returns The number of skipped HTTP requests.
+ * @throws runtime_error if the file is not a trace
+ */
+size_t loadTrace(const string &path, double speed, vector<Request> &requests, size_t &truncated)
+{
+  ifstream file(path, ios::binary);
+  TraceHeader header;
+  if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+      header.magic != TRACE_MAGIC || header.version != TRACE_VERSION ||
+      header.recordSize != sizeof(TraceRecord))
+  {
+    throw runtime_error(path + " is not a request trace");
+  }
+
+  TraceRecord record;
+  size_t skipped = 0;
+  truncated = 0;
+  while (file.read(reinterpret_cast<char *>(&record), sizeof(record))) {
+    if (record.transport == TraceHttp) {
+      skipped++;
+      continue;
+    }
+    if (record.commandSize > TRACE_COMMAND_SIZE) {
+      truncated++;
+      continue;
+    }
+    Request request;
+    request.command = string(record.command, record.commandSize) + "\n";
+    request.kind = requestKind(request.command);
+    request.datagram = record.transport == TraceUdp;
+    request.offset = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double, micro>(record.offsetUs / speed));
+    request.latencyMs = 0;
+    request.lateMs = 0;
+    request.failed = false;
+    requests.push_back(request);
+  }
+  return skipped;
+}
+
+/**
+ * @brief Returns a percentile of sorted values.
+ * @param sorted The values in ascending order, not empty.
+ * @param fraction The percentile, 0.5 for the median.
+ * @returns The value.
+ */
+double percentile(const vector<double> &sorted, double fraction)
+{
+  size_t index = (size_t) (fraction * sorted.size());
+  return sorted[index < sorted.size() ? index : sorted.size() - 1];
+}
+
+/**
+ * @brief Prints one line of the report.
+ * @param name The group name.
+ * @param latencies The latencies of the group in ms, sorted in place.
+ * @param failures The number of failed requests of the group.
+ */
+void reportLine(const string &name, vector<double> &latencies, size_t failures)
+{
+  sort(latencies.begin(), latencies.end());
+  cout << left << setw(10) << name << right << setw(8) << latencies.size() << setw(8) << failures;
+  if (latencies.empty()) {
+    cout << endl;
+    return;
+  }
+  cout << fixed << setprecision(2) << setw(10) << percentile(latencies, 0.5)
+    << setw(10) << percentile(latencies, 0.9) << setw(10) << percentile(latencies, 0.99)
+    << setw(10) << latencies.back() << endl;
+}
+
+/**
+ * @brief Program entry point
+ * @returns Zero on success, otherwise a nonzero error code.
+ */
+int main(int argc, char *argv[])
+{
+  double speed = 1;
+  int threads = DEFAULT_THREADS;
+  int first = 1;
+
+  while (first + 1 < argc && argv[first][0] == '-') {
+    if (string(argv[first]) == OPTION_SPEED) {
+      speed = atof(argv[first + 1]);
+    }
+    else if (string(argv[first]) == OPTION_THREADS) {
+      threads = atoi(argv[first + 1]);
+    }
+    else {
+      break;
+    }
+    first += 2;
+  }
+  if (argc - first != 2 || speed <= 0 || threads <= 0) {
+    cout << USAGE << endl;
+    return ErrArgs;
+  }
+  string host = argv[first];
+
+  vector<Request> requests;
+  size_t skipped, truncated;
+  try {
+    skipped = loadTrace(argv[first + 1], speed, requests, truncated);
+  }
+  catch (const std::exception &ex) {
+    cerr << "Exception: " << ex.what() << endl;
+    return ErrGeneral;
+  }
+  if (requests.empty()) {
+    cerr << "Nothing to replay" << endl;
+    return ErrGeneral;
+  }
+  Clock::duration firstOffset = requests.front().offset;
+  cout << "Replaying " << requests.size() << " requests (" << skipped << " HTTP and "
+    << truncated << " truncated skipped) at " << speed << "x with " << threads << " threads" << endl;
+
+  // every thread takes the next request in order and waits for its time
+  atomic<size_t> next(0);
+  atomic<unsigned long> timeouts(0);
+  Clock::time_point start = Clock::now();
+  vector<thread> pool;
+  for (int i = 0; i < threads; i++) {
+    pool.emplace_back([&]() {
+      io_service ioService;
+      ClientRequestProcessor client(&ioService);
+      ostream discard(nullptr);
+      size_t index;
+      while ((index = next++) < requests.size()) {
+        Request &request = requests[index];
+        Clock::time_point scheduled = start + (request.offset - firstOffset);
+        this_thread::sleep_until(scheduled);
+        Clock::time_point sent = Clock::now();
+        try {
+          if (request.datagram) {
+            client.processDatagram(discard, host, request.command);
+          }
+          else {
+            client.process(discard, host, request.command);
+          }
+        }
+        catch (const std::exception &) {
+          request.failed = true;
+        }
+        Clock::time_point done = Clock::now();
+        request.lateMs = std::chrono::duration<double, milli>(sent - scheduled).count();
+        request.latencyMs = std::chrono::duration<double, milli>(done - scheduled).count();
+      }
+      timeouts += client.timeouts();
+    });
+  }
+  for (thread &t : pool) {
+    t.join();
+  }
+  double elapsedMs = std::chrono::duration<double, milli>(Clock::now() - start).count();
+  double scheduleMs = std::chrono::duration<double, milli>(requests.back().offset - firstOffset).count();
+
+  // latency against the original schedule, per request kind and in total,
+  // every kind gets a group even if all its requests failed
+  map<string, vector<double> > latencies;
+  map<string, size_t> failures;
+  vector<double> all, late;
+  size_t failed = 0;
+  for (const Request &request : requests) {
+    vector<double> &group = latencies[request.kind];
+    late.push_back(request.lateMs);
+    if (request.failed) {
+      failures[request.kind]++;
+      failed++;
+      continue;
+    }
+    group.push_back(request.latencyMs);
+    all.push_back(request.latencyMs);
+  }
+
+  cout << fixed << setprecision(1) << "Schedule " << scheduleMs << " ms, replay took "
+    << elapsedMs << " ms, " << failed << " failed (" << timeouts << " timeouts)" << endl;
+  cout << "Latency from the scheduled time in ms:" << endl;
+  cout << left << setw(10) << "request" << right << setw(8) << "count" << setw(8) << "failed"
+    << setw(10) << "p50" << setw(10) << "p90" << setw(10) << "p99" << setw(10) << "max" << endl;
+  for (auto &group : latencies) {
+    reportLine(group.first, group.second, failures[group.first]);
+  }
+  reportLine("all", all, failed);
+  reportLine("sent late", late, 0);
+  return ErrOK;
+}
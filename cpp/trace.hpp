@@ -0,0 +1,59 @@
+/**
+ * @file trace.hpp
+ * @brief Layout of the request trace recorded by the server, see c/trace.h.
+ *
+ * @author Karel Dolezal, akwky@centrum.cz
+ */
+
+#ifndef _TRACE_HPP_
+#define _TRACE_HPP_
+
+#include <cstdint>
+
+// Identifies a trace file, "RQTR" in memory on little endian hosts
+#define TRACE_MAGIC   0x52545152
+// Layout version described by TraceRecord
+#define TRACE_VERSION 2
+// Number of request bytes kept, longer requests are truncated
+#define TRACE_COMMAND_SIZE 16
+
+/**
+ * How a traced request arrived, enum traceTransport of the server.
+ */
+enum TraceTransport
+{
+  TraceTcp = 0,
+  TraceUnix,
+  TraceUdp,
+  TraceHttp,
+  TraceSession,
+};
+
+/**
+ * The file header.
+ */
+struct TraceHeader
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t recordSize;
+  uint64_t startUs;
+};
+
+/**
+ * One request arrival.
+ */
+struct TraceRecord
+{
+  uint64_t offsetUs;
+  uint32_t peerAddress;
+  uint16_t peerPort;
+  uint8_t transport;
+  uint8_t commandSize;        // the whole length, truncated if above TRACE_COMMAND_SIZE
+  char command[TRACE_COMMAND_SIZE];
+};
+
+static_assert(sizeof(TraceHeader) == 16 && sizeof(TraceRecord) == 32,
+  "the layout must match the server");
+
+#endif